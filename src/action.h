@@ -0,0 +1,21 @@
+#ifndef INTERNET_OF_TANKS_ACTION_H
+#define INTERNET_OF_TANKS_ACTION_H
+
+/**
+ * Teams and actions of tanks, shared by world and the simulation engine
+ */
+
+enum Team
+{
+    GREEN, RED
+};
+
+enum Action
+{
+    UNDEFINED,
+    MOVE_UP, MOVE_DOWN, MOVE_RIGHT, MOVE_LEFT,
+    FIRE_UP, FIRE_DOWN, FIRE_RIGHT, FIRE_LEFT,
+    NO_ACTION
+};
+
+#endif //INTERNET_OF_TANKS_ACTION_H
@@ -0,0 +1,293 @@
+#include "archive.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syslog.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+static const char ARCHIVE_MAGIC[4] = {'I', 'O', 'T', 'A'};
+static const char TRAILER_MAGIC[4] = {'I', 'O', 'T', 'X'};
+static const uint32_t ARCHIVE_VERSION = 1;
+
+static size_t padded(size_t size)
+{
+    return (size + 3) & ~(size_t) 3;
+}
+
+std::vector<JournalTank> ArchiveSegment::keyframe() const
+{
+    std::vector<JournalTank> tanks(header->tankCount);
+    for (uint32_t i = 0; i < header->tankCount; i++) {
+        tanks[i] = JournalTank{tankIds[i], tankX[i], tankY[i], tankTeams[i]};
+    }
+    return tanks;
+}
+
+ArchiveWriter::ArchiveWriter(const std::string & path, int areaX, int areaY, int redCount, int greenCount,
+                             unsigned int keyframeInterval)
+    : path(path), keyframeInterval(keyframeInterval > 0 ? keyframeInterval : 1), offset(0),
+      game(0), segmentOpen(false), currentActions(0), currentEvents(0)
+{
+    file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        syslog(LOG_ERR, "fopen() of archive %s failed: %s", path.c_str(), strerror(errno));
+        throw std::runtime_error("Creating archive failed");
+    }
+
+    ArchiveHeader header = {};
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof header.magic);
+    header.version = ARCHIVE_VERSION;
+    header.areaX = areaX;
+    header.areaY = areaY;
+    header.redCount = redCount;
+    header.greenCount = greenCount;
+    header.keyframeInterval = this->keyframeInterval;
+    write(&header, sizeof header);
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    flushSegment();
+
+    while (offset % 8 != 0) {
+        write("", 1);
+    }
+    ArchiveTrailer trailer;
+    trailer.indexOffset = offset;
+    trailer.entryCount = (uint32_t) index.size();
+    memcpy(trailer.magic, TRAILER_MAGIC, sizeof trailer.magic);
+    writeColumn(index);
+    write(&trailer, sizeof trailer);
+
+    if (fclose(file) != 0) {
+        syslog(LOG_ERR, "writing archive %s failed: %s", path.c_str(), strerror(errno));
+    }
+}
+
+void ArchiveWriter::writeKeyframe(unsigned int round, const std::vector<JournalTank> & tanks)
+{
+    flushSegment();
+
+    segment = ArchiveSegmentHeader{game, round, 0, (uint32_t) tanks.size(), 0, 0};
+    keyframeTanks = tanks;
+    segmentOpen = true;
+}
+
+void ArchiveWriter::addAction(uint32_t tankId, uint8_t action)
+{
+    actionTankIds.push_back(tankId);
+    actions.push_back(action);
+    currentActions++;
+}
+
+void ArchiveWriter::addEvent(uint8_t type, int32_t x, int32_t y, int32_t x2, int32_t y2)
+{
+    events.push_back(ArchiveEvent{type, x, y, x2, y2});
+    currentEvents++;
+}
+
+void ArchiveWriter::finishRound()
+{
+    roundActions.push_back(currentActions);
+    roundEvents.push_back(currentEvents);
+    currentActions = 0;
+    currentEvents = 0;
+}
+
+void ArchiveWriter::finishGame()
+{
+    flushSegment();
+    if (!index.empty() && index.back().game == game) {
+        game++;
+    }
+}
+
+void ArchiveWriter::flushSegment()
+{
+    if (!segmentOpen) {
+        return;
+    }
+    segmentOpen = false;
+
+    segment.roundCount = (uint32_t) roundActions.size();
+    segment.actionCount = (uint32_t) actions.size();
+    segment.eventCount = (uint32_t) events.size();
+    index.push_back(ArchiveIndexEntry{segment.game, segment.round, offset});
+    write(&segment, sizeof segment);
+
+    size_t tankCount = keyframeTanks.size();
+    std::vector<uint32_t> ids(tankCount);
+    std::vector<int32_t> xs(tankCount), ys(tankCount);
+    std::vector<uint8_t> teams(tankCount);
+    for (size_t i = 0; i < tankCount; i++) {
+        ids[i] = keyframeTanks[i].id;
+        xs[i] = keyframeTanks[i].x;
+        ys[i] = keyframeTanks[i].y;
+        teams[i] = keyframeTanks[i].team;
+    }
+    writeColumn(ids);
+    writeColumn(xs);
+    writeColumn(ys);
+    writeColumn(teams);
+
+    writeColumn(roundActions);
+    writeColumn(roundEvents);
+    writeColumn(actionTankIds);
+    writeColumn(actions);
+
+    size_t eventCount = events.size();
+    std::vector<uint8_t> types(eventCount);
+    std::vector<int32_t> x(eventCount), y(eventCount), x2(eventCount), y2(eventCount);
+    for (size_t i = 0; i < eventCount; i++) {
+        types[i] = events[i].type;
+        x[i] = events[i].x;
+        y[i] = events[i].y;
+        x2[i] = events[i].x2;
+        y2[i] = events[i].y2;
+    }
+    writeColumn(types);
+    writeColumn(x);
+    writeColumn(y);
+    writeColumn(x2);
+    writeColumn(y2);
+
+    keyframeTanks.clear();
+    roundActions.clear();
+    roundEvents.clear();
+    actionTankIds.clear();
+    actions.clear();
+    events.clear();
+    currentActions = 0;
+    currentEvents = 0;
+}
+
+void ArchiveWriter::write(const void *data, size_t size)
+{
+    if (size > 0 && fwrite(data, size, 1, file) != 1) {
+        syslog(LOG_ERR, "writing archive %s failed: %s", path.c_str(), strerror(errno));
+    }
+    offset += size;
+}
+
+void ArchiveWriter::pad()
+{
+    static const char zeros[4] = {0, 0, 0, 0};
+    write(zeros, padded(offset) - offset);
+}
+
+ArchiveReader::ArchiveReader(const std::string & path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        syslog(LOG_ERR, "open() of archive %s failed: %s", path.c_str(), strerror(errno));
+        throw std::runtime_error("Opening archive failed");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        syslog(LOG_ERR, "fstat() of archive %s failed: %s", path.c_str(), strerror(errno));
+        close(fd);
+        throw std::runtime_error("Opening archive failed");
+    }
+    size = (size_t) st.st_size;
+    if (size < sizeof(ArchiveHeader) + sizeof(ArchiveTrailer)) {
+        close(fd);
+        throw std::runtime_error("Archive is truncated");
+    }
+
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        syslog(LOG_ERR, "mmap() of archive %s failed: %s", path.c_str(), strerror(errno));
+        throw std::runtime_error("Opening archive failed");
+    }
+    data = (const uint8_t *) mapped;
+
+    header = (const ArchiveHeader *) data;
+    trailer = (const ArchiveTrailer *) (data + size - sizeof(ArchiveTrailer));
+    if (memcmp(header->magic, ARCHIVE_MAGIC, sizeof ARCHIVE_MAGIC) != 0 || header->version != ARCHIVE_VERSION
+        || memcmp(trailer->magic, TRAILER_MAGIC, sizeof TRAILER_MAGIC) != 0 || trailer->indexOffset % 8 != 0
+        || trailer->indexOffset + (uint64_t) trailer->entryCount * sizeof(ArchiveIndexEntry)
+           + sizeof(ArchiveTrailer) != size) {
+        munmap(mapped, size);
+        throw std::runtime_error("Archive is corrupted or was not closed");
+    }
+    index = (const ArchiveIndexEntry *) (data + trailer->indexOffset);
+    madvise(mapped, size, MADV_RANDOM);
+}
+
+ArchiveReader::~ArchiveReader()
+{
+    munmap((void *) data, size);
+}
+
+long ArchiveReader::findKeyframe(uint32_t game, uint32_t round) const
+{
+    const ArchiveIndexEntry *end = index + trailer->entryCount;
+    const ArchiveIndexEntry *next = std::upper_bound(index, end, ArchiveIndexEntry{game, round, 0},
+        [](const ArchiveIndexEntry & a, const ArchiveIndexEntry & b) {
+            return a.game < b.game || (a.game == b.game && a.round < b.round);
+        });
+    if (next == index || (next - 1)->game != game) {
+        return -1;
+    }
+    return (next - 1) - index;
+}
+
+ArchiveSegment ArchiveReader::segment(uint32_t i) const
+{
+    uint64_t offset = index[i].offset;
+    uint64_t limit = i + 1 < trailer->entryCount ? index[i + 1].offset : trailer->indexOffset;
+    if (offset % 4 != 0 || offset + sizeof(ArchiveSegmentHeader) > limit) {
+        throw std::runtime_error("Archive segment is corrupted");
+    }
+
+    ArchiveSegment segment;
+    segment.header = (const ArchiveSegmentHeader *) (data + offset);
+    const ArchiveSegmentHeader & h = *segment.header;
+
+    uint64_t tanks = h.tankCount, rounds = h.roundCount, actions = h.actionCount, events = h.eventCount;
+    uint64_t needed = sizeof(ArchiveSegmentHeader) + 12 * tanks + padded(tanks) + 8 * rounds
+                      + 4 * actions + padded(actions) + padded(events) + 16 * events;
+    if (offset + needed > limit) {
+        throw std::runtime_error("Archive segment is corrupted");
+    }
+
+    const uint8_t *p = data + offset + sizeof(ArchiveSegmentHeader);
+    segment.tankIds = (const uint32_t *) p;         p += 4 * tanks;
+    segment.tankX = (const int32_t *) p;            p += 4 * tanks;
+    segment.tankY = (const int32_t *) p;            p += 4 * tanks;
+    segment.tankTeams = p;                          p += padded(tanks);
+    segment.roundActions = (const uint32_t *) p;    p += 4 * rounds;
+    segment.roundEvents = (const uint32_t *) p;     p += 4 * rounds;
+    segment.actionTankIds = (const uint32_t *) p;   p += 4 * actions;
+    segment.actions = p;                            p += padded(actions);
+    segment.eventTypes = p;                         p += padded(events);
+    segment.eventX = (const int32_t *) p;           p += 4 * events;
+    segment.eventY = (const int32_t *) p;           p += 4 * events;
+    segment.eventX2 = (const int32_t *) p;          p += 4 * events;
+    segment.eventY2 = (const int32_t *) p;
+
+    // Per-round counts and tank ids index the columns and the world, so they are checked before use
+    uint64_t roundActionSum = 0, roundEventSum = 0;
+    for (uint64_t round = 0; round < rounds; round++) {
+        roundActionSum += segment.roundActions[round];
+        roundEventSum += segment.roundEvents[round];
+    }
+    if (roundActionSum > actions || roundEventSum > events) {
+        throw std::runtime_error("Archive segment is corrupted");
+    }
+    uint64_t tankLimit = (uint64_t) std::max(0, header->redCount) + (uint64_t) std::max(0, header->greenCount);
+    for (uint64_t tank = 0; tank < tanks; tank++) {
+        if (segment.tankIds[tank] >= tankLimit) {
+            throw std::runtime_error("Archive segment is corrupted");
+        }
+    }
+    return segment;
+}
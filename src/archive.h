@@ -0,0 +1,222 @@
+#ifndef INTERNET_OF_TANKS_ARCHIVE_H
+#define INTERNET_OF_TANKS_ARCHIVE_H
+
+#include "journal.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Seekable archive of games.
+ *
+ * The archive is a sequence of segments followed by an index and a trailer. Every segment starts with
+ * a keyframe (full placement of tanks before its first round) followed by columns of actions and
+ * events of up to keyframeInterval rounds. All columns are 4 byte aligned, so the archive can be
+ * read directly from mmap-ed memory. The index lists game, round and offset of every keyframe,
+ * so any round is reached by simulating at most keyframeInterval rounds.
+ */
+
+struct ArchiveHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t areaX;
+    int32_t areaY;
+    int32_t redCount;
+    int32_t greenCount;
+    uint32_t keyframeInterval;
+    uint32_t reserved;
+};
+
+struct ArchiveSegmentHeader
+{
+    uint32_t game;          //<< number of game in the archive, starting from 0
+    uint32_t round;         //<< round of the keyframe, segment contains rounds round + 1 .. round + roundCount
+    uint32_t roundCount;
+    uint32_t tankCount;
+    uint32_t actionCount;
+    uint32_t eventCount;
+};
+
+struct ArchiveIndexEntry
+{
+    uint32_t game;
+    uint32_t round;
+    uint64_t offset;        //<< offset of ArchiveSegmentHeader
+};
+
+struct ArchiveTrailer
+{
+    uint64_t indexOffset;
+    uint32_t entryCount;
+    char magic[4];
+};
+
+struct ArchiveEvent
+{
+    uint8_t type;           //<< LogEvent
+    int32_t x;
+    int32_t y;
+    int32_t x2;
+    int32_t y2;
+};
+
+/**
+ * Columns of one segment pointing into the mapped archive
+ */
+struct ArchiveSegment
+{
+    const ArchiveSegmentHeader *header;
+
+    const uint32_t *tankIds;
+    const int32_t *tankX;
+    const int32_t *tankY;
+    const uint8_t *tankTeams;
+
+    const uint32_t *roundActions;   //<< number of actions in every round
+    const uint32_t *roundEvents;    //<< number of events in every round
+
+    const uint32_t *actionTankIds;
+    const uint8_t *actions;
+
+    const uint8_t *eventTypes;
+    const int32_t *eventX;
+    const int32_t *eventY;
+    const int32_t *eventX2;
+    const int32_t *eventY2;
+
+    /**
+     * Get keyframe as placement of tanks ordered by id
+     */
+    std::vector<JournalTank> keyframe() const;
+};
+
+class ArchiveWriter
+{
+public:
+
+    /**
+     * @throw runtime_error if archive cannot be created
+     */
+    ArchiveWriter(const std::string & path, int areaX, int areaY, int redCount, int greenCount,
+                  unsigned int keyframeInterval);
+
+    /**
+     * Write current segment and the index
+     */
+    ~ArchiveWriter();
+
+    /**
+     * Whether next round has to start with new keyframe
+     */
+    bool needsKeyframe() const
+    {
+        return !segmentOpen || roundActions.size() >= keyframeInterval;
+    }
+
+    /**
+     * Start new segment with placement of tanks before round + 1
+     */
+    void writeKeyframe(unsigned int round, const std::vector<JournalTank> & tanks);
+
+    void addAction(uint32_t tankId, uint8_t action);
+
+    void addEvent(uint8_t type, int32_t x, int32_t y, int32_t x2 = 0, int32_t y2 = 0);
+
+    void finishRound();
+
+    /**
+     * Following keyframes belong to the next game
+     */
+    void finishGame();
+
+private:
+    FILE *file;
+    std::string path;
+    unsigned int keyframeInterval;
+    uint64_t offset;
+
+    uint32_t game;
+    bool segmentOpen;
+    ArchiveSegmentHeader segment;
+    std::vector<JournalTank> keyframeTanks;
+
+    std::vector<uint32_t> roundActions;
+    std::vector<uint32_t> roundEvents;
+    uint32_t currentActions;
+    uint32_t currentEvents;
+
+    std::vector<uint32_t> actionTankIds;
+    std::vector<uint8_t> actions;
+    std::vector<ArchiveEvent> events;
+
+    std::vector<ArchiveIndexEntry> index;
+
+    void flushSegment();
+
+    void write(const void *data, size_t size);
+
+    template<typename T>
+    void writeColumn(const std::vector<T> & column)
+    {
+        write(column.data(), column.size() * sizeof(T));
+        pad();
+    }
+
+    /**
+     * Align offset to 4 bytes
+     */
+    void pad();
+};
+
+class ArchiveReader
+{
+public:
+
+    /**
+     * Map the archive into memory
+     * @throw runtime_error if archive cannot be mapped or is corrupted
+     */
+    ArchiveReader(const std::string & path);
+
+    ~ArchiveReader();
+
+    const ArchiveHeader & getHeader() const
+    {
+        return *header;
+    }
+
+    uint32_t keyframeCount() const
+    {
+        return trailer->entryCount;
+    }
+
+    const ArchiveIndexEntry & keyframe(uint32_t i) const
+    {
+        return index[i];
+    }
+
+    /**
+     * Find the last keyframe of game at or before round using binary search in index
+     * @return index of keyframe or -1 if there is no such keyframe
+     */
+    long findKeyframe(uint32_t game, uint32_t round) const;
+
+    /**
+     * Get columns of segment starting with keyframe i
+     * @throw runtime_error if segment is corrupted
+     */
+    ArchiveSegment segment(uint32_t i) const;
+
+private:
+    const uint8_t *data;
+    size_t size;
+
+    const ArchiveHeader *header;
+    const ArchiveTrailer *trailer;
+    const ArchiveIndexEntry *index;
+};
+
+#endif //INTERNET_OF_TANKS_ARCHIVE_H
@@ -0,0 +1,222 @@
+#include "arena.h"
+
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+using std::runtime_error;
+
+const size_t INBOX_CAPACITY = 4096;
+
+ArenaHost::ArenaHost(unsigned int arenaCount,
+                     int areaX,
+                     int areaY,
+                     int redCount,
+                     int greenCount,
+                     const std::string & pipePrefix,
+                     useconds_t roundTime,
+                     unsigned int seed,
+                     unsigned int threads)
+    : roundTime(roundTime), sd_listen(-1), ingestPackets(0), ingestTime(0), pool(threads), placed(arenaCount, 0),
+      clientLimit(std::max(INBOX_CAPACITY, 2 * (size_t) arenaCount * (size_t) std::max(0, redCount + greenCount)))
+{
+    if (arenaCount == 0) {
+        throw runtime_error("Creating arenas failed: no arena");
+    }
+    sd_listen = World::openListenSocket();
+    try {
+        for (unsigned int i = 0; i < arenaCount; i++) {
+            inboxes.emplace_back(new SpscQueue<ClientPacket>(INBOX_CAPACITY));
+            arenas.emplace_back(new World(areaX, areaY, redCount, greenCount, pipePath(pipePrefix, i), roundTime,
+                                          seed + i, sd_listen, inboxes.back().get()));
+        }
+    }
+    catch (const runtime_error & error) {
+        arenas.clear();
+        close(sd_listen);
+        throw;
+    }
+}
+
+ArenaHost::~ArenaHost()
+{
+    arenas.clear();
+    close(sd_listen);
+}
+
+void ArenaHost::init()
+{
+    // Arenas are initialized one by one, so placement depends only on seed
+    for (std::unique_ptr<World> & arena : arenas) {
+        arena->init();
+    }
+}
+
+void ArenaHost::requestRestart()
+{
+    for (std::unique_ptr<World> & arena : arenas) {
+        arena->requestRestart();
+    }
+}
+
+void ArenaHost::performRound()
+{
+    RoundStats::Clock::time_point start = RoundStats::Clock::now();
+
+    receiveMessages();
+
+    // Exception must not leave worker thread, the first one is thrown after all arenas finished
+    std::vector<std::exception_ptr> failures(arenas.size());
+    pool.parallelFor(arenas.size(), 1, [this, &failures](size_t begin, size_t end, unsigned int) {
+        for (size_t i = begin; i < end; i++) {
+            try {
+                arenas[i]->performRound();
+            }
+            catch (...) {
+                failures[i] = std::current_exception();
+            }
+        }
+    });
+    for (size_t i = 0; i < failures.size(); i++) {
+        if (failures[i]) {
+            syslog(LOG_ERR, "round of arena %zu failed", i);
+            std::rethrow_exception(failures[i]);
+        }
+    }
+    forgetDepartedClients();
+
+    long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(RoundStats::Clock::now() - start).count();
+    if (elapsed < (long) roundTime) {
+        usleep((useconds_t) (roundTime - elapsed));
+    }
+}
+
+void ArenaHost::limitIngestion(unsigned int packets, useconds_t time)
+{
+    ingestPackets = packets;
+    ingestTime = time;
+    for (std::unique_ptr<World> & arena : arenas) {
+        arena->limitIngestion(packets, time);
+    }
+}
+
+void ArenaHost::limitClients(double rate, double burst)
+{
+    for (std::unique_ptr<World> & arena : arenas) {
+        arena->limitClients(rate, burst);
+    }
+}
+
+void ArenaHost::setSessionTimeout(unsigned int rounds)
+{
+    for (std::unique_ptr<World> & arena : arenas) {
+        arena->setSessionTimeout(rounds);
+    }
+}
+
+std::vector<const RoundStats*> ArenaHost::getStats() const
+{
+    std::vector<const RoundStats*> stats;
+    for (const std::unique_ptr<World> & arena : arenas) {
+        stats.push_back(&arena->getStats());
+    }
+    return stats;
+}
+
+std::string ArenaHost::pipePath(const std::string & pipePrefix, unsigned int arena)
+{
+    return pipePrefix + "." + std::to_string(arena);
+}
+
+void ArenaHost::receiveMessages()
+{
+    ClientPacket packet;
+    char buffer[16];
+    RoundStats::Clock::time_point start = RoundStats::Clock::now();
+    std::fill(placed.begin(), placed.end(), 0);
+
+    // Every arena takes at most ingestPackets from its inbox, so the host receives as many for each arena
+    size_t budget = (size_t) ingestPackets * arenas.size();
+    for (size_t received = 0; budget == 0 || received < budget; received++) {
+        if (ingestTime != 0 && RoundStats::Clock::now() - start >= std::chrono::microseconds(ingestTime)) {
+            return;
+        }
+        socklen_t fromlen = sizeof packet.from;
+        ssize_t length = recvfrom(sd_listen, buffer, sizeof buffer - 1, MSG_DONTWAIT,
+                                  (struct sockaddr*)&packet.from, &fromlen);
+        if (length == -1) {
+            if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                syslog(LOG_ERR, "recvfrom() failed: %s", strerror(errno));
+                throw runtime_error("recvfrom() failed");
+            }
+            return;
+        }
+
+        if (length > 1 && buffer[0] == ARENA_JOIN) {
+            buffer[length] = '\0';
+            char *end;
+            unsigned long arena = strtoul(buffer + 1, &end, 10);
+            if (*end == '\0' && arena < arenas.size()) {
+                auto client = clientArena.find(packet.from);
+                if (client != clientArena.end()) {
+                    client->second = arena;
+                } else if (clientArena.size() < clientLimit) {
+                    clientArena.insert(std::make_pair(packet.from, (size_t) arena));
+                }
+            }
+            continue;
+        }
+        if (length != 2) {
+            continue;
+        }
+
+        size_t arena;
+        auto client = clientArena.find(packet.from);
+        if (client != clientArena.end()) {
+            arena = client->second;
+        } else {
+            arena = placeClient();
+            if (clientArena.size() < clientLimit) {
+                clientArena.insert(std::make_pair(packet.from, arena));
+            }
+        }
+        memcpy(packet.command, buffer, 2);
+        // Full inbox drops the packet as full socket buffer would
+        if (!inboxes[arena]->push(packet)) {
+            arenas[arena]->countInboxOverflow();
+        }
+    }
+}
+
+void ArenaHost::forgetDepartedClients()
+{
+    for (std::unique_ptr<World> & arena : arenas) {
+        arena->takeDepartedClients(departed);
+    }
+    for (const struct sockaddr_in & addr : departed) {
+        clientArena.erase(addr);
+    }
+    departed.clear();
+}
+
+size_t ArenaHost::placeClient()
+{
+    size_t best = 0;
+    long bestFree = 0;
+    for (size_t i = 0; i < arenas.size(); i++) {
+        long free = (long) arenas[i]->getFreeTankCount() - (long) placed[i];
+        if (i == 0 || free > bestFree) {
+            best = i;
+            bestFree = free;
+        }
+    }
+    placed[best]++;
+    return best;
+}
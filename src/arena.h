@@ -0,0 +1,115 @@
+#ifndef INTERNET_OF_TANKS_ARENA_H
+#define INTERNET_OF_TANKS_ARENA_H
+
+#include "threadpool.h"
+#include "world.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * First byte of packet by which client joins an arena, it is followed by decimal index of the arena
+ */
+const char ARENA_JOIN = '@';
+
+/**
+ * Many independent games hosted by one process on one port. Rounds of all arenas are performed
+ * together by a shared pool of threads. Client joins an arena by sending "@<N>" before its first
+ * command, client which starts with a command is placed into the arena with most free tanks.
+ * Every arena has its own gameboard, stats and pipe "<pipe>.<N>".
+ */
+class ArenaHost
+{
+public:
+    /**
+     * Create arenas with the same parameters, random placement of arena i is seeded by seed + i
+     * @param threads number of threads performing rounds, 0 means number of CPUs
+     * @throw runtime_error when parameters are invalid or the socket cannot be created
+     */
+    ArenaHost(unsigned int arenaCount,
+              int areaX,
+              int areaY,
+              int redCount,
+              int greenCount,
+              const std::string & pipePrefix,
+              useconds_t roundTime,
+              unsigned int seed,
+              unsigned int threads);
+
+    virtual ~ArenaHost();
+
+    /**
+     * Initialize games of all arenas
+     * @throw runtime_error when some error occurs
+     */
+    void init();
+
+    /**
+     * Restart games of all arenas, see World::requestRestart
+     */
+    void requestRestart();
+
+    /**
+     * Pass received packets to their arenas, perform one round of every arena and wait for the end of round
+     */
+    void performRound();
+
+    /**
+     * Limit receiving of messages of every arena, see World::limitIngestion
+     */
+    void limitIngestion(unsigned int packets, useconds_t time);
+
+    /**
+     * Limit rate of every client, see World::limitClients
+     */
+    void limitClients(double rate, double burst);
+
+    /**
+     * Release tanks of idle clients of every arena, see World::setSessionTimeout
+     */
+    void setSessionTimeout(unsigned int rounds);
+
+    /**
+     * Get stats of all arenas ordered by index
+     */
+    std::vector<const RoundStats*> getStats() const;
+
+    /**
+     * Get path of pipe of arena
+     */
+    static std::string pipePath(const std::string & pipePrefix, unsigned int arena);
+
+private:
+    useconds_t roundTime;
+    int sd_listen;              //<< socket shared by all arenas
+    unsigned int ingestPackets; //<< packets received in one round for every arena at most, 0 is unlimited
+    useconds_t ingestTime;      //<< time of receiving in one round at most, 0 is unlimited
+    ThreadPool pool;            //<< performs rounds of arenas
+
+    std::vector<std::unique_ptr<SpscQueue<ClientPacket> > > inboxes;   //<< packets of arenas indexed by arena
+    std::vector<std::unique_ptr<World> > arenas;
+
+    std::map<struct sockaddr_in, size_t, SockAddrComparator> clientArena;  //<< arena of known clients
+    std::vector<size_t> placed;     //<< clients placed into arena in the current round, they have no tank yet
+    size_t clientLimit;         //<< clients remembered in clientArena at most, the others are placed by every packet
+    std::vector<struct sockaddr_in> departed;   //<< clients whose sessions expired in the current round
+
+    /**
+     * Receive packets from socket and pass them into inboxes of their arenas
+     */
+    void receiveMessages();
+
+    /**
+     * Forget arena of clients whose sessions expired in their arenas
+     */
+    void forgetDepartedClients();
+
+    /**
+     * Choose arena with most free tanks for a new client
+     */
+    size_t placeClient();
+};
+
+#endif //INTERNET_OF_TANKS_ARENA_H
@@ -0,0 +1,416 @@
+#include "engine.h"
+#include "tank.h"
+#include "world.h"
+#include "worldclient.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Microbenchmarks of hot paths of world and worldclient. Every benchmark prints median and minimum
+ * of its samples, so results of two builds on the same machine can be compared directly.
+ * Usage: worldbench [filter], only benchmarks whose name contains filter are run.
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static const int BOARD_SIZES[] = {32, 128, 256};
+static const int FRAME_SIZES[] = {64, 256, 1024};
+static const double DENSITIES[] = {0.02, 0.10};
+
+enum Scenario
+{
+    FIRE_HEAVY,     //<< every tank fires
+    MOVE_HEAVY,     //<< every tank moves, crashes are rare
+    CRASH_HEAVY     //<< tanks stand in pairs and drive into each other
+};
+
+static double nanoseconds(Clock::duration duration)
+{
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+static std::string params(int size, double density)
+{
+    char buf[64];
+    snprintf(buf, sizeof buf, "%dx%d %2.0f%%", size, size, density * 100);
+    return buf;
+}
+
+static void report(const char *name, const std::string & params, const char *unit, std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    printf("%-30s %-18s %14.1f %14.1f  %-8s %6zu\n", name, params.c_str(),
+           samples[samples.size() / 2], samples.front(), unit, samples.size());
+    fflush(stdout);
+}
+
+class Benchmark
+{
+public:
+
+    /**
+     * Place tanks to random free fields, for CRASH_HEAVY the tanks are placed in horizontal pairs
+     */
+    static std::vector<JournalTank> placement(int size, double density, Scenario scenario, std::mt19937 & random)
+    {
+        size_t count = std::max((size_t) 2, (size_t) (density * size * size)) & ~(size_t) 1;
+        std::vector<JournalTank> tanks;
+        std::set<std::pair<int, int> > used;
+        while (tanks.size() < count) {
+            int x = (int) (random() % size);
+            int y = (int) (random() % size);
+            if (scenario == CRASH_HEAVY) {
+                x &= ~1;
+                if (!used.insert(std::make_pair(x, y)).second) {
+                    continue;
+                }
+                tanks.push_back(JournalTank{(uint32_t) tanks.size(), x, y, GREEN});
+                tanks.push_back(JournalTank{(uint32_t) tanks.size(), x + 1, y, RED});
+            } else if (used.insert(std::make_pair(x, y)).second) {
+                tanks.push_back(JournalTank{(uint32_t) tanks.size(), x, y, (uint8_t) (tanks.size() % 2 ? RED : GREEN)});
+            }
+        }
+        return tanks;
+    }
+
+    static std::vector<Action> actions(const std::vector<JournalTank> & tanks, Scenario scenario, std::mt19937 & random)
+    {
+        const Action moves[] = {MOVE_UP, MOVE_DOWN, MOVE_LEFT, MOVE_RIGHT};
+        const Action fires[] = {FIRE_UP, FIRE_DOWN, FIRE_LEFT, FIRE_RIGHT};
+        std::vector<Action> result(tanks.size());
+        for (size_t i = 0; i < tanks.size(); i++) {
+            switch (scenario) {
+                case FIRE_HEAVY:
+                    result[i] = fires[random() % 4];
+                    break;
+                case MOVE_HEAVY:
+                    result[i] = moves[random() % 4];
+                    break;
+                case CRASH_HEAVY:
+                    result[i] = tanks[i].team == GREEN ? MOVE_RIGHT : MOVE_LEFT;
+                    break;
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Time one round of World::performActions, the world is created again before every sample
+     */
+    static void performActions(const char *name, Scenario scenario)
+    {
+        for (int size : BOARD_SIZES) {
+            for (double density : DENSITIES) {
+                std::mt19937 random(1);
+                JournalGame game = {size, size, 0, 0, 1, {}};
+                World world(game);
+                std::vector<JournalTank> tanks = placement(size, density, scenario, random);
+                std::vector<Action> tankActions = actions(tanks, scenario, random);
+
+                int iterations = std::max(5, std::min(50, (int) (20000 / tanks.size())));
+                std::vector<double> samples;
+                for (int i = 0; i < iterations; i++) {
+                    world.initFromPlacement(tanks, 0);
+                    for (const JournalTank & tank : tanks) {
+                        world.replayActions[tank.id] = tankActions[tank.id];
+                        world.replayTanks.push_back(tank.id);
+                    }
+
+                    Clock::time_point start = Clock::now();
+                    world.performActions();
+                    samples.push_back(nanoseconds(Clock::now() - start));
+                }
+                report(name, params(size, density), "ns/round", samples);
+            }
+        }
+    }
+
+    /**
+     * Time one round of Engine::step on the same boards as performActions
+     */
+    static void engineStep(const char *name, Scenario scenario)
+    {
+        for (int size : BOARD_SIZES) {
+            for (double density : DENSITIES) {
+                std::mt19937 random(1);
+                std::vector<JournalTank> tanks = placement(size, density, scenario, random);
+                std::vector<Action> tankActions = actions(tanks, scenario, random);
+                std::vector<uint8_t> engineActions(tankActions.begin(), tankActions.end());
+
+                std::vector<double> samples;
+                for (int i = 0; i < 50; i++) {
+                    Engine engine(size, size);
+                    for (const JournalTank & tank : tanks) {
+                        engine.addTank((Team) tank.team, tank.x, tank.y);
+                    }
+
+                    Clock::time_point start = Clock::now();
+                    engine.step(engineActions.data());
+                    samples.push_back(nanoseconds(Clock::now() - start));
+                }
+                report(name, params(size, density), "ns/round", samples);
+            }
+        }
+    }
+
+    /**
+     * Time EngineBatch::step of many small worlds with random actions and observations
+     */
+    static void engineBatch()
+    {
+        const size_t counts[] = {1024, 16384};
+        const int size = 16;
+        const int teamSize = 16;
+
+        for (size_t count : counts) {
+            EngineBatch batch(count, size, size, teamSize, teamSize, 1);
+            batch.setAutoReset(true);
+
+            std::mt19937 random(1);
+            std::vector<uint8_t> engineActions(count * batch.getTankCount());
+            std::vector<uint8_t> observations(count * size * size);
+            std::vector<double> samples;
+            for (int i = 0; i < 50; i++) {
+                for (uint8_t & action : engineActions) {
+                    action = (uint8_t) (MOVE_UP + random() % (NO_ACTION - MOVE_UP + 1));
+                }
+
+                Clock::time_point start = Clock::now();
+                batch.step(engineActions.data(), observations.data());
+                samples.push_back(nanoseconds(Clock::now() - start) / count);
+            }
+
+            char buf[64];
+            snprintf(buf, sizeof buf, "%zu x %dx%d", count, size, size);
+            report("EngineBatch::step", buf, "ns/world", samples);
+        }
+    }
+
+    static void printGameBoard()
+    {
+        for (int size : BOARD_SIZES) {
+            for (double density : DENSITIES) {
+                std::mt19937 random(1);
+                JournalGame game = {size, size, 0, 0, 1, {}};
+                World world(game);
+                world.setBoardOutput("/dev/null");
+                world.initFromPlacement(placement(size, density, MOVE_HEAVY, random), 0);
+
+                std::vector<double> samples;
+                for (int i = 0; i < 50; i++) {
+                    Clock::time_point start = Clock::now();
+                    world.printGameBoard();
+                    samples.push_back(nanoseconds(Clock::now() - start));
+                }
+                report("World::printGameBoard", params(size, density), "ns/frame", samples);
+            }
+        }
+    }
+
+    static void parseAction()
+    {
+        const char *messages[] = {"mu", "md", "ml", "mr", "fu", "fd", "fl", "fr", "no", "xx"};
+        const int calls = 1000000;
+
+        Tank *tank = new Tank();
+        tank->waitForTank();
+
+        volatile int sink = 0;
+        std::vector<double> samples;
+        for (int i = 0; i < 20; i++) {
+            Clock::time_point start = Clock::now();
+            for (int j = 0; j < calls; j++) {
+                sink += tank->parseAction(messages[j % 10]);
+            }
+            samples.push_back(nanoseconds(Clock::now() - start) / calls);
+        }
+        report("Tank::parseAction", "10 messages", "ns/call", samples);
+
+        tank->markAsDestroyed()->notify();
+        delete tank;
+    }
+
+    /**
+     * Time World::receiveMessages draining datagrams sent over loopback by several clients.
+     * Needs free port of world.
+     */
+    static void receiveMessages()
+    {
+        const int clientCount = 16;
+        const int packetCounts[] = {64, 256};
+
+        std::string pipe = "/dev/null";
+        World *world;
+        try {
+            world = new World(64, 64, 32, 32, pipe, 0, 1);
+        } catch (std::runtime_error & error) {
+            printf("%-30s skipped, %s\n", "World::receiveMessages", error.what());
+            return;
+        }
+        world->init();
+
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof addr;
+        getsockname(world->sd_listen, (struct sockaddr *) &addr, &addrlen);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        std::vector<int> clients;
+        for (int i = 0; i < clientCount; i++) {
+            clients.push_back(socket(AF_INET, SOCK_DGRAM, 0));
+        }
+
+        char reply[2];
+        for (int packets : packetCounts) {
+            std::vector<double> samples;
+            for (int i = 0; i < 31; i++) {
+                for (int j = 0; j < packets; j++) {
+                    sendto(clients[j % clientCount], "mu", 2, 0, (struct sockaddr *) &addr, sizeof addr);
+                }
+
+                Clock::time_point start = Clock::now();
+                world->receiveMessages();
+                double elapsed = nanoseconds(Clock::now() - start);
+
+                // The first sample assigns tanks to clients
+                if (i > 0) {
+                    samples.push_back(elapsed / packets);
+                }
+                for (int client : clients) {
+                    while (recv(client, reply, sizeof reply, MSG_DONTWAIT) > 0) { }
+                }
+            }
+            char buf[64];
+            snprintf(buf, sizeof buf, "%d clients %d pkts", clientCount, packets);
+            report("World::receiveMessages", buf, "ns/pkt", samples);
+        }
+
+        for (int client : clients) {
+            close(client);
+        }
+        delete world;
+    }
+
+    /**
+     * Frame in the format which world prints into pipe
+     */
+    static std::string frame(int size, double density, std::mt19937 & random)
+    {
+        std::string result = boardHeader(size, size, random());
+        result.reserve(result.size() + 2 * (size_t) size * size);
+        std::uniform_real_distribution<double> distribution(0, 1);
+        for (long i = 0; i < (long) size * size; i++) {
+            double draw = distribution(random);
+            result += draw < density / 2 ? 'g' : draw < density ? 'r' : '0';
+            result += ',';
+        }
+        return result;
+    }
+
+    /**
+     * Time finding the newest of several queued frames and decoding it, as worldclient does
+     * when it catches up, and building the zoom pyramid of the decoded frame
+     */
+    static void parseFrames()
+    {
+        const int queued = 4;
+
+        for (int size : FRAME_SIZES) {
+            for (double density : DENSITIES) {
+                std::mt19937 random(1);
+                std::string data = frame(size, density, random);
+                WorldClient client;
+
+                std::vector<double> parseSamples;
+                std::vector<double> pyramidSamples;
+                for (int i = 0; i < 20; i++) {
+                    client.pipeBuffer.clear();
+                    for (int j = 0; j < queued; j++) {
+                        client.pipeBuffer += data;
+                    }
+
+                    Clock::time_point start = Clock::now();
+                    size_t frameStart;
+                    size_t body;
+                    int frameX;
+                    int frameY;
+                    uint64_t hash;
+                    if (client.findNewestFrame(frameStart, frameX, frameY, hash, body) != 0) {
+                        throw std::runtime_error("frame not found");
+                    }
+                    client.consumePipeBuffer(client.decodeFrame(body, frameX, frameY));
+                    Clock::time_point parsed = Clock::now();
+                    client.reducedBoard(client.maxZoom());
+                    Clock::time_point reduced = Clock::now();
+
+                    parseSamples.push_back(nanoseconds(parsed - start));
+                    pyramidSamples.push_back(nanoseconds(reduced - parsed));
+                }
+                report("WorldClient frame parsing", params(size, density), "ns/frame", parseSamples);
+                report("WorldClient::reducedBoard", params(size, density), "ns/frame", pyramidSamples);
+            }
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    std::string filter = argc > 1 ? argv[1] : "";
+    auto selected = [&](const char *name) {
+        return std::string(name).find(filter) != std::string::npos;
+    };
+
+    printf("%-30s %-18s %14s %14s  %-8s %6s\n", "benchmark", "parameters", "median", "min", "unit", "n");
+
+    try {
+        if (selected("performActions fire")) {
+            Benchmark::performActions("performActions fire-heavy", FIRE_HEAVY);
+        }
+        if (selected("performActions move")) {
+            Benchmark::performActions("performActions move-heavy", MOVE_HEAVY);
+        }
+        if (selected("performActions crash")) {
+            Benchmark::performActions("performActions crash-heavy", CRASH_HEAVY);
+        }
+        if (selected("Engine::step fire")) {
+            Benchmark::engineStep("Engine::step fire-heavy", FIRE_HEAVY);
+        }
+        if (selected("Engine::step move")) {
+            Benchmark::engineStep("Engine::step move-heavy", MOVE_HEAVY);
+        }
+        if (selected("Engine::step crash")) {
+            Benchmark::engineStep("Engine::step crash-heavy", CRASH_HEAVY);
+        }
+        if (selected("EngineBatch")) {
+            Benchmark::engineBatch();
+        }
+        if (selected("printGameBoard")) {
+            Benchmark::printGameBoard();
+        }
+        if (selected("parseAction")) {
+            Benchmark::parseAction();
+        }
+        if (selected("receiveMessages")) {
+            Benchmark::receiveMessages();
+        }
+        if (selected("WorldClient")) {
+            Benchmark::parseFrames();
+        }
+    } catch (std::runtime_error & error) {
+        fprintf(stderr, "benchmark failed: %s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
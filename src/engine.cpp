@@ -0,0 +1,423 @@
+#include "engine.h"
+#include "eventlog.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using std::runtime_error;
+
+namespace
+{
+    uint64_t key(const EngineState & state, int32_t id)
+    {
+        uint64_t cell = (uint64_t) state.y[id] * state.areaX + state.x[id];
+        return cell << 32 | (uint32_t) id;
+    }
+
+    void destroy(EngineState & state, int32_t id)
+    {
+        if (state.status[id] == TANK_ALIVE) {
+            state.alive[state.team[id]]--;
+        }
+        state.status[id] = TANK_DESTROYED;
+    }
+
+    /**
+     * Remove tank from gameboard, its field is cleared
+     */
+    void remove(EngineState & state, int32_t id, EngineScratch & scratch)
+    {
+        destroy(state, id);
+        state.status[id] = TANK_GONE;
+        state.grid[state.y[id] * state.areaX + state.x[id]] = -1;
+        scratch.removed.push_back((uint32_t) id);
+    }
+
+    void addEvent(std::vector<EngineEvent> *events, LogEvent type, int32_t x, int32_t y, int32_t x2, int32_t y2)
+    {
+        if (events != nullptr) {
+            events->push_back(EngineEvent{type, x, y, x2, y2});
+        }
+    }
+
+    /**
+     * Hit every tank on fields (x, y) + i * (dx, dy) for i in [0, count)
+     */
+    void shoot(EngineState & state, int32_t id, int32_t x, int32_t y, int dx, int dy, int count,
+               EngineScratch & scratch, std::vector<EngineEvent> *events)
+    {
+        for (int i = 0; i < count; i++, x += dx, y += dy) {
+            int32_t victim = state.grid[y * state.areaX + x];
+            if (victim != -1) {
+                addEvent(events, TANK_HIT, state.x[id], state.y[id], x, y);
+                if (state.status[victim] == TANK_ALIVE) {
+                    scratch.hit.push_back(key(state, victim));
+                }
+                destroy(state, victim);
+            }
+        }
+    }
+
+    /**
+     * Move tank to neighbour field, tanks crash if the field is occupied
+     */
+    void drive(EngineState & state, int32_t id, int dx, int dy, EngineScratch & scratch,
+               std::vector<EngineEvent> *events)
+    {
+        int32_t x = state.x[id] + dx;
+        int32_t y = state.y[id] + dy;
+        if (x < 0 || x >= state.areaX || y < 0 || y >= state.areaY) {
+            addEvent(events, TANK_ROLLED_OFF, state.x[id], state.y[id], 0, 0);
+            remove(state, id, scratch);
+            return;
+        }
+
+        int32_t & target = state.grid[y * state.areaX + x];
+        if (target != -1) {
+            addEvent(events, TANK_CRASH, state.x[id], state.y[id], x, y);
+            remove(state, target, scratch);
+            remove(state, id, scratch);
+            return;
+        }
+
+        state.grid[state.y[id] * state.areaX + state.x[id]] = -1;
+        target = id;
+        state.x[id] = x;
+        state.y[id] = y;
+    }
+}
+
+namespace engine
+{
+    void step(EngineState & state, const uint8_t *actions, EngineScratch & scratch, std::vector<EngineEvent> *events)
+    {
+        order(state, scratch);
+        fire(state, actions, scratch, events);
+        move(state, actions, scratch, events);
+        (*state.round)++;
+    }
+
+    void order(const EngineState & state, EngineScratch & scratch)
+    {
+        // Tanks act in the row-major order of their fields at the beginning of the round. Tank moved by
+        // World::performActions is never reached again in the same round, so the order does not change.
+        std::vector<uint64_t> & order = scratch.order;
+        order.clear();
+        scratch.hit.clear();
+        scratch.removed.clear();
+        size_t cells = (size_t) state.areaX * state.areaY;
+        if (cells <= 8 * (size_t) state.tankCount) {
+            for (size_t cell = 0; cell < cells; cell++) {
+                if (state.grid[cell] != -1) {
+                    order.push_back((uint64_t) state.grid[cell]);
+                }
+            }
+        } else {
+            for (uint32_t id = 0; id < state.tankCount; id++) {
+                if (state.status[id] != TANK_GONE) {
+                    order.push_back(key(state, (int32_t) id));
+                }
+            }
+            std::sort(order.begin(), order.end());
+        }
+    }
+
+    void order(const EngineState & state, const uint32_t *ids, size_t count, EngineScratch & scratch)
+    {
+        std::vector<uint64_t> & order = scratch.order;
+        order.clear();
+        scratch.hit.clear();
+        scratch.removed.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (state.status[ids[i]] != TANK_GONE) {
+                order.push_back(key(state, (int32_t) ids[i]));
+            }
+        }
+        std::sort(order.begin(), order.end());
+    }
+
+    void orderHit(EngineScratch & scratch)
+    {
+        // Hit tanks have not moved yet, so their items are the same as at the beginning of the round
+        std::vector<uint64_t> & order = scratch.order;
+        std::sort(scratch.hit.begin(), scratch.hit.end());
+        size_t middle = order.size();
+        order.insert(order.end(), scratch.hit.begin(), scratch.hit.end());
+        std::inplace_merge(order.begin(), order.begin() + middle, order.end());
+        order.erase(std::unique(order.begin(), order.end()), order.end());
+    }
+
+    void fire(EngineState & state, const uint8_t *actions, EngineScratch & scratch,
+              std::vector<EngineEvent> *events)
+    {
+        // Every tank fires, even tank destroyed earlier in the round. Shot hits all tanks in its direction.
+        for (uint64_t key : scratch.order) {
+            int32_t id = (int32_t) (uint32_t) key;
+            int32_t x = state.x[id];
+            int32_t y = state.y[id];
+            switch (actions[id]) {
+                case FIRE_UP:
+                    shoot(state, id, x, 0, 0, 1, y, scratch, events);
+                    break;
+                case FIRE_DOWN:
+                    shoot(state, id, x, y + 1, 0, 1, state.areaY - y - 1, scratch, events);
+                    break;
+                case FIRE_RIGHT:
+                    shoot(state, id, x + 1, y, 1, 0, state.areaX - x - 1, scratch, events);
+                    break;
+                case FIRE_LEFT:
+                    shoot(state, id, 0, y, 1, 0, x, scratch, events);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    void move(EngineState & state, const uint8_t *actions, EngineScratch & scratch,
+              std::vector<EngineEvent> *events)
+    {
+        // Destroyed tanks are removed when reached, tanks removed by crash are skipped
+        for (uint64_t key : scratch.order) {
+            int32_t id = (int32_t) (uint32_t) key;
+            if (state.status[id] == TANK_GONE) {
+                continue;
+            }
+            if (state.status[id] == TANK_DESTROYED) {
+                remove(state, id, scratch);
+                continue;
+            }
+            switch (actions[id]) {
+                case MOVE_UP:
+                    drive(state, id, 0, -1, scratch, events);
+                    break;
+                case MOVE_DOWN:
+                    drive(state, id, 0, 1, scratch, events);
+                    break;
+                case MOVE_RIGHT:
+                    drive(state, id, 1, 0, scratch, events);
+                    break;
+                case MOVE_LEFT:
+                    drive(state, id, -1, 0, scratch, events);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    void observe(const EngineState & state, uint8_t *board)
+    {
+        size_t cells = (size_t) state.areaX * state.areaY;
+        for (size_t cell = 0; cell < cells; cell++) {
+            int32_t id = state.grid[cell];
+            board[cell] = id == -1 ? CELL_EMPTY : state.team[id] == GREEN ? CELL_GREEN : CELL_RED;
+        }
+    }
+
+    uint64_t zobrist(uint32_t id, uint8_t team, uint64_t cell)
+    {
+        // Finalizer of splitmix64
+        uint64_t z = (cell << 33 | (uint64_t) id << 1 | team) + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t hash(const EngineState & state)
+    {
+        uint64_t hash = 0;
+        for (uint32_t id = 0; id < state.tankCount; id++) {
+            if (state.status[id] != TANK_GONE) {
+                hash ^= zobrist(id, state.team[id], (uint64_t) state.y[id] * state.areaX + state.x[id]);
+            }
+        }
+        return hash;
+    }
+
+    void updateHash(const EngineState & state, const EngineScratch & scratch, uint64_t & hash)
+    {
+        // Removed tanks keep their last field, so moved tanks are moved in hash first and then
+        // every removed tank is taken out of hash on the field where it was removed
+        for (uint64_t key : scratch.order) {
+            uint32_t id = (uint32_t) key;
+            uint64_t cell = (uint64_t) state.y[id] * state.areaX + state.x[id];
+            if (cell != key >> 32) {
+                hash ^= zobrist(id, state.team[id], key >> 32) ^ zobrist(id, state.team[id], cell);
+            }
+        }
+        for (uint32_t id : scratch.removed) {
+            hash ^= zobrist(id, state.team[id], (uint64_t) state.y[id] * state.areaX + state.x[id]);
+        }
+    }
+
+    void place(EngineState & state, int redCount, int greenCount, std::mt19937_64 & random)
+    {
+        std::fill(state.grid, state.grid + (size_t) state.areaX * state.areaY, -1);
+        state.alive[GREEN] = (uint32_t) greenCount;
+        state.alive[RED] = (uint32_t) redCount;
+        *state.round = 0;
+
+        for (uint32_t id = 0; id < state.tankCount; id++) {
+            int32_t x;
+            int32_t y;
+            do {
+                x = (int32_t) (random() % state.areaX);
+                y = (int32_t) (random() % state.areaY);
+            } while (state.grid[y * state.areaX + x] != -1);
+
+            state.grid[y * state.areaX + x] = (int32_t) id;
+            state.x[id] = x;
+            state.y[id] = y;
+            state.team[id] = (uint8_t) (id < (uint32_t) greenCount ? GREEN : RED);
+            state.status[id] = TANK_ALIVE;
+        }
+    }
+}
+
+/* Engine */
+
+Engine::Engine(int areaX, int areaY)
+    : areaX(areaX), areaY(areaY), round(0), alive{0, 0}
+{
+    if (areaX <= 0 || areaY <= 0) {
+        throw runtime_error("Creating engine failed: invalid parameters");
+    }
+    grid.assign((size_t) areaX * areaY, -1);
+}
+
+Engine::Engine(int areaX, int areaY, int redCount, int greenCount, uint64_t seed)
+    : Engine(areaX, areaY)
+{
+    if (redCount < 0 || greenCount < 0 || (long) areaX * areaY < (long) redCount + greenCount) {
+        throw runtime_error("Creating engine failed: invalid parameters");
+    }
+
+    size_t tankCount = (size_t) redCount + greenCount;
+    x.resize(tankCount);
+    y.resize(tankCount);
+    team.resize(tankCount);
+    status.resize(tankCount);
+
+    std::mt19937_64 random(seed);
+    EngineState current = state();
+    engine::place(current, redCount, greenCount, random);
+}
+
+uint32_t Engine::addTank(Team team, int x, int y)
+{
+    if (x < 0 || x >= areaX || y < 0 || y >= areaY) {
+        throw runtime_error("Adding tank failed: tank out of gameboard");
+    }
+    int32_t & field = grid[(size_t) y * areaX + x];
+    if (field != -1) {
+        throw runtime_error("Adding tank failed: position is occupied");
+    }
+
+    uint32_t id = (uint32_t) this->team.size();
+    field = (int32_t) id;
+    this->x.push_back(x);
+    this->y.push_back(y);
+    this->team.push_back((uint8_t) team);
+    status.push_back(TANK_ALIVE);
+    alive[team]++;
+    return id;
+}
+
+void Engine::step(const uint8_t *actions, std::vector<EngineEvent> *events)
+{
+    if (events != nullptr) {
+        events->clear();
+    }
+    EngineState current = state();
+    engine::step(current, actions, scratch, events);
+}
+
+void Engine::observe(uint8_t *board) const
+{
+    engine::observe(const_cast<Engine *>(this)->state(), board);
+}
+
+EngineState Engine::state()
+{
+    return EngineState{areaX, areaY, (uint32_t) team.size(), grid.data(), x.data(), y.data(),
+                       team.data(), status.data(), alive, &round};
+}
+
+/* EngineBatch */
+
+EngineBatch::EngineBatch(size_t count, int areaX, int areaY, int redCount, int greenCount, uint64_t seed,
+                         unsigned int threads)
+    : count(count), areaX(areaX), areaY(areaY), redCount(redCount), greenCount(greenCount),
+      tankCount((uint32_t) (redCount + greenCount)), autoReset(false), pool(threads)
+{
+    if (areaX <= 0 || areaY <= 0 || redCount < 0 || greenCount < 0
+        || (long) areaX * areaY < (long) redCount + greenCount) {
+        throw runtime_error("Creating engine batch failed: invalid parameters");
+    }
+
+    size_t cells = (size_t) areaX * areaY;
+    grid.resize(count * cells);
+    x.resize(count * tankCount);
+    y.resize(count * tankCount);
+    team.resize(count * tankCount);
+    status.resize(count * tankCount);
+    alive.resize(2 * count);
+    rounds.resize(count);
+    resets.resize(count);
+    scratch.resize(pool.size());
+
+    randoms.reserve(count);
+    for (size_t world = 0; world < count; world++) {
+        randoms.push_back(std::mt19937_64(seed + world));
+        reset(world);
+    }
+}
+
+void EngineBatch::step(const uint8_t *actions, uint8_t *observations, std::vector<EngineEvent> *events)
+{
+    size_t cells = (size_t) areaX * areaY;
+
+    // Worlds are small, so several of them are stepped by one chunk to amortize scheduling
+    size_t chunk = std::max((size_t) 1, count / (pool.size() * 8));
+    pool.parallelFor(count, chunk, [&](size_t begin, size_t end, unsigned int worker) {
+        for (size_t world = begin; world < end; world++) {
+            std::vector<EngineEvent> *worldEvents = events != nullptr ? &events[world] : nullptr;
+            if (worldEvents != nullptr) {
+                worldEvents->clear();
+            }
+
+            EngineState current = state(world);
+            engine::step(current, actions + world * tankCount, scratch[worker], worldEvents);
+
+            resets[world] = autoReset && isFinished(world);
+            if (resets[world]) {
+                reset(world);
+            }
+            if (observations != nullptr) {
+                engine::observe(current, observations + world * cells);
+            }
+        }
+    });
+}
+
+void EngineBatch::reset(size_t world)
+{
+    EngineState current = state(world);
+    engine::place(current, redCount, greenCount, randoms[world]);
+}
+
+void EngineBatch::observe(size_t world, uint8_t *board) const
+{
+    engine::observe(state(world), board);
+}
+
+EngineState EngineBatch::state(size_t world) const
+{
+    EngineBatch *self = const_cast<EngineBatch *>(this);
+    size_t cells = (size_t) areaX * areaY;
+    size_t tanks = world * tankCount;
+    return EngineState{areaX, areaY, tankCount, self->grid.data() + world * cells, self->x.data() + tanks,
+                       self->y.data() + tanks, self->team.data() + tanks, self->status.data() + tanks,
+                       self->alive.data() + 2 * world, self->rounds.data() + world};
+}
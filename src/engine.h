@@ -0,0 +1,354 @@
+#ifndef INTERNET_OF_TANKS_ENGINE_H
+#define INTERNET_OF_TANKS_ENGINE_H
+
+#include "action.h"
+#include "threadpool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/**
+ * In-process simulation of the game without threads, sockets and pipes. A round performed by
+ * the engine gives the same gameboard and the same events as World::performActions with the
+ * same actions, so the engine can be used for training and testing of tank strategies.
+ */
+
+/**
+ * Cells of observed gameboard
+ */
+enum EngineCell : uint8_t
+{
+    CELL_EMPTY, CELL_GREEN, CELL_RED
+};
+
+/**
+ * Tank status, destroyed tanks stay on the gameboard until the move phase reaches them
+ */
+enum EngineStatus : uint8_t
+{
+    TANK_GONE, TANK_ALIVE, TANK_DESTROYED
+};
+
+/**
+ * Game event, type is TANK_HIT, TANK_CRASH or TANK_ROLLED_OFF from eventlog.h
+ */
+struct EngineEvent
+{
+    uint16_t type;
+    int32_t x;      //<< aggressor
+    int32_t y;
+    int32_t x2;     //<< victim, unused for TANK_ROLLED_OFF
+    int32_t y2;
+};
+
+/**
+ * View of one world stored in arrays owned by Engine or EngineBatch
+ */
+struct EngineState
+{
+    int areaX;
+    int areaY;
+    uint32_t tankCount;
+    int32_t *grid;      //<< areaX * areaY tank ids in row-major order, -1 is empty field
+    int32_t *x;         //<< tankCount positions
+    int32_t *y;
+    uint8_t *team;      //<< tankCount teams
+    uint8_t *status;    //<< tankCount EngineStatus
+    uint32_t *alive;    //<< alive tanks of GREEN and RED
+    uint32_t *round;
+};
+
+/**
+ * Buffers reused by consecutive rounds, one per thread
+ */
+struct EngineScratch
+{
+    std::vector<uint64_t> order;
+    std::vector<uint64_t> hit;          //<< tanks destroyed by fire phase, items as in order
+    std::vector<uint32_t> removed;      //<< ids of tanks removed by move phase
+};
+
+namespace engine
+{
+    /**
+     * Perform one round, actions are indexed by tank id
+     * @param events are appended if not null
+     */
+    void step(EngineState & state, const uint8_t *actions, EngineScratch & scratch, std::vector<EngineEvent> *events);
+
+    /**
+     * Fill scratch.order by tanks on gameboard in row-major order of their fields, tank id is
+     * in the low 32 bits of every item. The order is used by fire and move phases of the round.
+     */
+    void order(const EngineState & state, EngineScratch & scratch);
+
+    /**
+     * Fill scratch.order by given tanks only, the tanks which are not on gameboard are skipped.
+     * Other tanks must have no action in the round, they are added to the order by orderHit
+     * when they are hit, so the round costs nothing for them.
+     */
+    void order(const EngineState & state, const uint32_t *ids, size_t count, EngineScratch & scratch);
+
+    /**
+     * Add tanks hit by the fire phase to the order given by ids, they are removed by move phase
+     */
+    void orderHit(EngineScratch & scratch);
+
+    /**
+     * Fire phase of the round, hit tanks are marked as destroyed and added to scratch.hit
+     */
+    void fire(EngineState & state, const uint8_t *actions, EngineScratch & scratch,
+              std::vector<EngineEvent> *events);
+
+    /**
+     * Move phase of the round, destroyed tanks are removed from gameboard. Removed tanks
+     * are added to scratch.removed.
+     */
+    void move(EngineState & state, const uint8_t *actions, EngineScratch & scratch,
+              std::vector<EngineEvent> *events);
+
+    /**
+     * Write areaX * areaY EngineCell values in row-major order into board
+     */
+    void observe(const EngineState & state, uint8_t *board);
+
+    /**
+     * Zobrist key of tank on field, hash of a world is xor of keys of all tanks on its gameboard.
+     * Keys are computed from tank id, team and field instead of a random table, so all worlds
+     * and all engine variants hash the same state to the same value.
+     */
+    uint64_t zobrist(uint32_t id, uint8_t team, uint64_t cell);
+
+    /**
+     * Compute hash of all tanks on gameboard
+     */
+    uint64_t hash(const EngineState & state);
+
+    /**
+     * Update hash by changes of the move phase of the round, it costs only tanks in scratch.order and
+     * scratch.removed. Items of scratch.order must hold fields of tanks, as order of given tanks makes them.
+     */
+    void updateHash(const EngineState & state, const EngineScratch & scratch, uint64_t & hash);
+
+    /**
+     * Remove all tanks and place green tanks and then red tanks to random free fields
+     */
+    void place(EngineState & state, int redCount, int greenCount, std::mt19937_64 & random);
+}
+
+/**
+ * Single world owning its state
+ */
+class Engine
+{
+public:
+
+    /**
+     * Create empty world, tanks are added by addTank
+     * @throw runtime_error when parameters are invalid
+     */
+    Engine(int areaX, int areaY);
+
+    /**
+     * Create world with tanks on random positions
+     * @throw runtime_error when parameters are invalid
+     */
+    Engine(int areaX, int areaY, int redCount, int greenCount, uint64_t seed);
+
+    /**
+     * Add tank on given field
+     * @return id of the tank
+     * @throw runtime_error when the field is outside of gameboard or occupied
+     */
+    uint32_t addTank(Team team, int x, int y);
+
+    /**
+     * Perform one round
+     * @param actions Action of every tank indexed by its id, actions of removed tanks are ignored
+     * @param events are cleared and filled by events of the round if not null
+     */
+    void step(const uint8_t *actions, std::vector<EngineEvent> *events = nullptr);
+
+    void observe(uint8_t *board) const;
+
+    int getAreaX() const
+    {
+        return areaX;
+    }
+
+    int getAreaY() const
+    {
+        return areaY;
+    }
+
+    uint32_t getTankCount() const
+    {
+        return (uint32_t) team.size();
+    }
+
+    uint32_t getRoundCount() const
+    {
+        return round;
+    }
+
+    /**
+     * Check if tank was not removed from gameboard
+     */
+    bool isAlive(uint32_t id) const
+    {
+        return status[id] != TANK_GONE;
+    }
+
+    int getX(uint32_t id) const
+    {
+        return x[id];
+    }
+
+    int getY(uint32_t id) const
+    {
+        return y[id];
+    }
+
+    Team getTeam(uint32_t id) const
+    {
+        return (Team) team[id];
+    }
+
+    uint32_t getAlive(Team team) const
+    {
+        return alive[team];
+    }
+
+    /**
+     * Check if at least one team has no tank
+     */
+    bool isFinished() const
+    {
+        return alive[GREEN] == 0 || alive[RED] == 0;
+    }
+
+private:
+    int areaX;
+    int areaY;
+    uint32_t round;
+    uint32_t alive[2];
+    std::vector<int32_t> grid;
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+    std::vector<uint8_t> team;
+    std::vector<uint8_t> status;
+    EngineScratch scratch;
+
+    EngineState state();
+};
+
+/**
+ * Many worlds of the same size and the same tank counts stepped together. State of all worlds
+ * is stored in contiguous arrays, one array per attribute, and the worlds are stepped in parallel.
+ */
+class EngineBatch
+{
+public:
+
+    /**
+     * @param seed world i is placed by random generator seeded by seed + i
+     * @param threads number of stepping threads, 0 means number of CPUs
+     * @throw runtime_error when parameters are invalid
+     */
+    EngineBatch(size_t count, int areaX, int areaY, int redCount, int greenCount, uint64_t seed,
+                unsigned int threads = 0);
+
+    /**
+     * Perform one round in every world
+     * @param actions getTankCount() actions of every world, world after world
+     * @param observations if not null, filled by getAreaX() * getAreaY() cells of every world after the round
+     * @param events if not null, array of size() vectors which are cleared and filled by events of the world
+     */
+    void step(const uint8_t *actions, uint8_t *observations = nullptr, std::vector<EngineEvent> *events = nullptr);
+
+    /**
+     * Place tanks of world again and set its round count to zero
+     */
+    void reset(size_t world);
+
+    /**
+     * Reset finished worlds at the end of step, observations show the new game
+     */
+    void setAutoReset(bool autoReset)
+    {
+        this->autoReset = autoReset;
+    }
+
+    /**
+     * Check if world was reset by the last step
+     */
+    bool wasReset(size_t world) const
+    {
+        return resets[world] != 0;
+    }
+
+    bool isFinished(size_t world) const
+    {
+        return alive[2 * world + GREEN] == 0 || alive[2 * world + RED] == 0;
+    }
+
+    uint32_t getAlive(size_t world, Team team) const
+    {
+        return alive[2 * world + team];
+    }
+
+    uint32_t getRoundCount(size_t world) const
+    {
+        return rounds[world];
+    }
+
+    void observe(size_t world, uint8_t *board) const;
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    int getAreaX() const
+    {
+        return areaX;
+    }
+
+    int getAreaY() const
+    {
+        return areaY;
+    }
+
+    uint32_t getTankCount() const
+    {
+        return tankCount;
+    }
+
+private:
+    size_t count;
+    int areaX;
+    int areaY;
+    int redCount;
+    int greenCount;
+    uint32_t tankCount;
+    bool autoReset;
+
+    std::vector<int32_t> grid;
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+    std::vector<uint8_t> team;
+    std::vector<uint8_t> status;
+    std::vector<uint32_t> alive;
+    std::vector<uint32_t> rounds;
+    std::vector<uint8_t> resets;
+    std::vector<std::mt19937_64> randoms;
+
+    ThreadPool pool;
+    std::vector<EngineScratch> scratch;     //<< one per thread of pool
+
+    EngineState state(size_t world) const;
+};
+
+#endif //INTERNET_OF_TANKS_ENGINE_H
@@ -0,0 +1,201 @@
+#include "eventlog.h"
+
+#include <time.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+std::atomic_int EventLog::level(-1);
+thread_local EventLog::RingOwner EventLog::owner;
+
+std::mutex EventLog::ringsMtx;
+std::vector<EventLog::Ring*> EventLog::rings;
+unsigned long EventLog::orphanedDropped = 0;
+
+std::thread *EventLog::drainThread = nullptr;
+std::mutex EventLog::drainMtx;
+std::condition_variable EventLog::drainCV;
+bool EventLog::running = false;
+FILE *EventLog::file = nullptr;
+unsigned long EventLog::reportedDropped = 0;
+
+static const char *EVENT_FORMATS[LOG_EVENT_COUNT] = {
+    "round num %d started",
+    "printing round %d",
+    "Aggresor at [%d,%d] destroy tank at [%d,%d].",
+    "Tank at [%d,%d] crashed into tank at [%d,%d].",
+    "Tank with at [%d,%d] rolled off the map.",
+    "no more tanks for clients",
+    "client of tank %d left after %d idle rounds",
+    "round %d board hash %08x%08x"
+};
+
+static const char *PRIORITY_NAMES[] = {
+    "EMERG", "ALERT", "CRIT", "ERR", "WARNING", "NOTICE", "INFO", "DEBUG"
+};
+
+void EventLog::start(const std::string & path, int level)
+{
+    if (!path.empty()) {
+        if ((file = fopen(path.c_str(), "a")) == nullptr) {
+            syslog(LOG_ERR, "fopen() of log file %s failed: %s", path.c_str(), strerror(errno));
+            throw std::runtime_error("Opening log file failed");
+        }
+    }
+
+    running = true;
+    drainThread = new std::thread(&EventLog::drainFnc);
+    setLevel(level);
+}
+
+void EventLog::stop()
+{
+    if (drainThread == nullptr) {
+        return;
+    }
+    setLevel(-1);
+
+    {
+        std::unique_lock<std::mutex> uniqueLock(drainMtx);
+        running = false;
+        drainCV.notify_all();
+    }
+    drainThread->join();
+    delete drainThread;
+    drainThread = nullptr;
+
+    if (file != nullptr) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+void EventLog::setLevel(int level)
+{
+    EventLog::level.store(level, std::memory_order_relaxed);
+}
+
+int EventLog::getLevel()
+{
+    return level.load(std::memory_order_relaxed);
+}
+
+unsigned long EventLog::droppedRecords()
+{
+    std::unique_lock<std::mutex> uniqueLock(ringsMtx);
+    unsigned long dropped = orphanedDropped;
+    for (Ring *ring : rings) {
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+void EventLog::append(int priority, LogEvent event, int32_t a, int32_t b, int32_t c, int32_t d)
+{
+    Ring *ring = owner.ring;
+    if (ring == nullptr) {
+        ring = new Ring;
+        owner.ring = ring;
+        std::unique_lock<std::mutex> uniqueLock(ringsMtx);
+        rings.push_back(ring);
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == Ring::CAPACITY) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    Record & record = ring->records[head % Ring::CAPACITY];
+    record.timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    record.event = event;
+    record.priority = (uint16_t) priority;
+    record.args[0] = a;
+    record.args[1] = b;
+    record.args[2] = c;
+    record.args[3] = d;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void EventLog::drainFnc()
+{
+    std::unique_lock<std::mutex> uniqueLock(drainMtx);
+    while (running) {
+        uniqueLock.unlock();
+        drainRings();
+        uniqueLock.lock();
+        drainCV.wait_for(uniqueLock, std::chrono::milliseconds(10));
+    }
+    uniqueLock.unlock();
+    drainRings();
+}
+
+void EventLog::drainRings()
+{
+    std::unique_lock<std::mutex> uniqueLock(ringsMtx);
+
+    unsigned long dropped = orphanedDropped;
+    auto iter = rings.begin();
+    while (iter != rings.end()) {
+        Ring *ring = *iter;
+
+        // Owner could append records until it is marked as orphaned
+        bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+        for (; tail != head; tail++) {
+            write(ring->records[tail % Ring::CAPACITY]);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+        if (orphaned) {
+            orphanedDropped += ring->dropped.load(std::memory_order_relaxed);
+            delete ring;
+            iter = rings.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+
+    if (dropped != reportedDropped) {
+        if (file != nullptr) {
+            fprintf(file, "%lu log records dropped\n", dropped - reportedDropped);
+        } else {
+            syslog(LOG_WARNING, "%lu log records dropped", dropped - reportedDropped);
+        }
+        reportedDropped = dropped;
+    }
+
+    if (file != nullptr) {
+        fflush(file);
+    }
+}
+
+void EventLog::write(const Record & record)
+{
+    char message[256];
+    const char *format = record.event < LOG_EVENT_COUNT ? EVENT_FORMATS[record.event] : "unknown event %d";
+    snprintf(message, sizeof message, format,
+             record.event < LOG_EVENT_COUNT ? record.args[0] : record.event,
+             record.args[1], record.args[2], record.args[3]);
+
+    if (file == nullptr) {
+        syslog(record.priority, "%s", message);
+        return;
+    }
+
+    char date[32];
+    time_t seconds = (time_t) (record.timestamp / 1000000000);
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    strftime(date, sizeof date, "%Y-%m-%d %H:%M:%S", &tm);
+    fprintf(file, "%s.%06lu %s %s\n", date, (unsigned long) (record.timestamp % 1000000000) / 1000,
+            record.priority < 8 ? PRIORITY_NAMES[record.priority] : "?", message);
+}
@@ -0,0 +1,141 @@
+#ifndef INTERNET_OF_TANKS_EVENTLOG_H
+#define INTERNET_OF_TANKS_EVENTLOG_H
+
+#include <syslog.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Events which can be logged. Message of each event is formatted by the drain thread.
+ */
+enum LogEvent : uint16_t
+{
+    ROUND_STARTED,      //<< round
+    BOARD_PRINTED,      //<< round
+    TANK_HIT,           //<< aggressorX, aggressorY, victimX, victimY
+    TANK_CRASH,         //<< aggressorX, aggressorY, victimX, victimY
+    TANK_ROLLED_OFF,    //<< x, y
+    NO_FREE_TANK,
+    SESSION_EXPIRED,    //<< tank id, idle rounds
+    ROUND_HASHED,       //<< round, high and low half of board hash
+    LOG_EVENT_COUNT
+};
+
+/**
+ * Asynchronous log of binary records. Every thread appends records into its own lock-free ring buffer,
+ * background thread formats them and writes them into syslog or file.
+ */
+class EventLog
+{
+public:
+
+    /**
+     * Start the drain thread. Nothing is logged before start.
+     * @param path of log file, records are sent to syslog if it is empty
+     * @param level maximal syslog priority which is logged
+     * @throw runtime_error if log file cannot be opened
+     */
+    static void start(const std::string & path, int level);
+
+    /**
+     * Write all remaining records and stop the drain thread
+     */
+    static void stop();
+
+    static void setLevel(int level);
+
+    static int getLevel();
+
+    /**
+     * Get number of records which were dropped because ring buffer of their thread was full
+     */
+    static unsigned long droppedRecords();
+
+    /**
+     * Append record into ring buffer of calling thread. Never blocks and never calls the kernel,
+     * record is dropped if the buffer is full.
+     */
+    static void log(int priority, LogEvent event, int32_t a = 0, int32_t b = 0, int32_t c = 0, int32_t d = 0)
+    {
+        if (priority <= level.load(std::memory_order_relaxed)) {
+            append(priority, event, a, b, c, d);
+        }
+    }
+
+private:
+
+    struct Record
+    {
+        uint64_t timestamp;     //<< nanoseconds since epoch
+        uint16_t event;
+        uint16_t priority;
+        int32_t args[4];
+    };
+
+    /**
+     * Single producer single consumer ring of records
+     */
+    struct Ring
+    {
+        static const uint64_t CAPACITY = 8192;
+
+        std::atomic<uint64_t> head;     //<< written by owning thread
+        char headPadding[64];           //<< keep head and tail in different cache lines
+        std::atomic<uint64_t> tail;     //<< written by drain thread
+        char tailPadding[64];
+        std::atomic<unsigned long> dropped;
+        std::atomic_bool orphaned;                  //<< owning thread has finished
+        Record records[CAPACITY];
+
+        Ring() : head(0), tail(0), dropped(0), orphaned(false) { }
+    };
+
+    /**
+     * Marks ring of the thread as orphaned when the thread ends
+     */
+    struct RingOwner
+    {
+        Ring *ring = nullptr;
+
+        ~RingOwner()
+        {
+            if (ring != nullptr) {
+                ring->orphaned = true;
+            }
+        }
+    };
+
+    static std::atomic_int level;
+    static thread_local RingOwner owner;
+
+    static std::mutex ringsMtx;
+    static std::vector<Ring*> rings;
+    static unsigned long orphanedDropped;   //<< dropped records of deleted rings
+
+    static std::thread *drainThread;
+    static std::mutex drainMtx;
+    static std::condition_variable drainCV;
+    static bool running;
+    static FILE *file;
+    static unsigned long reportedDropped;
+
+    static void append(int priority, LogEvent event, int32_t a, int32_t b, int32_t c, int32_t d);
+
+    static void drainFnc();
+
+    /**
+     * Write all records which are in rings at the moment and delete rings of finished threads
+     */
+    static void drainRings();
+
+    static void write(const Record & record);
+};
+
+#endif //INTERNET_OF_TANKS_EVENTLOG_H
@@ -0,0 +1,163 @@
+#include "journal.h"
+
+#include <sys/stat.h>
+#include <sys/syslog.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+static const char JOURNAL_MAGIC[4] = {'I', 'O', 'T', 'J'};
+static const uint32_t JOURNAL_VERSION = 1;
+
+// Records bigger than this are considered corrupted
+static const uint32_t MAX_RECORD_ITEMS = 1 << 28;
+
+JournalWriter::JournalWriter(const std::string & path)
+{
+    // Record torn by crash of the previous session is cut off, so the new records can be read
+    uint64_t length = 0;
+    struct stat status;
+    if (stat(path.c_str(), &status) == 0 && status.st_size > 0) {
+        try {
+            JournalReader reader(path);
+            JournalGame game;
+            JournalRound round;
+            JournalEnd end;
+            while (reader.read(game, round, end) > JOURNAL_EOF) {
+            }
+            length = reader.position();
+        }
+        catch (const std::runtime_error & error) {
+            throw std::runtime_error("Creating journal failed: file exists and is not a journal");
+        }
+        if ((uint64_t) status.st_size != length && truncate(path.c_str(), (off_t) length) == -1) {
+            syslog(LOG_ERR, "truncate() of journal %s failed: %s", path.c_str(), strerror(errno));
+            throw std::runtime_error("Creating journal failed");
+        }
+    }
+
+    out.open(path, std::ios::binary | std::ios::app);
+    if (!out) {
+        syslog(LOG_ERR, "opening journal %s failed", path.c_str());
+        throw std::runtime_error("Creating journal failed");
+    }
+    if (length == 0) {
+        out.write(JOURNAL_MAGIC, sizeof JOURNAL_MAGIC);
+        put(JOURNAL_VERSION);
+    }
+}
+
+void JournalWriter::writeGame(const JournalGame & game)
+{
+    put((uint8_t) JOURNAL_GAME);
+    put(game.areaX);
+    put(game.areaY);
+    put(game.redCount);
+    put(game.greenCount);
+    put(game.seed);
+    putTanks(game.tanks);
+}
+
+void JournalWriter::writeRound(const JournalRound & round)
+{
+    put((uint8_t) JOURNAL_ROUND);
+    put(round.round);
+    put((uint32_t) round.actions.size());
+    for (const JournalAction & action : round.actions) {
+        put(action.tankId);
+        put(action.action);
+    }
+}
+
+void JournalWriter::writeEnd(const JournalEnd & end)
+{
+    put((uint8_t) JOURNAL_END);
+    put(end.rounds);
+    putTanks(end.tanks);
+    out.flush();
+}
+
+void JournalWriter::putTanks(const std::vector<JournalTank> & tanks)
+{
+    put((uint32_t) tanks.size());
+    for (const JournalTank & tank : tanks) {
+        put(tank.id);
+        put(tank.x);
+        put(tank.y);
+        put(tank.team);
+    }
+}
+
+JournalReader::JournalReader(const std::string & path)
+    : in(path, std::ios::binary), recordEnd(0)
+{
+    char magic[sizeof JOURNAL_MAGIC];
+    uint32_t version;
+    if (!in || !in.read(magic, sizeof magic) || memcmp(magic, JOURNAL_MAGIC, sizeof magic) != 0
+        || !get(version) || version != JOURNAL_VERSION) {
+        syslog(LOG_ERR, "%s is not a journal of version %u", path.c_str(), JOURNAL_VERSION);
+        throw std::runtime_error("Opening journal failed");
+    }
+    recordEnd = sizeof magic + sizeof version;
+}
+
+JournalRecord JournalReader::read(JournalGame & game, JournalRound & round, JournalEnd & end)
+{
+    uint8_t type;
+    if (!get(type)) {
+        return in.eof() ? JOURNAL_EOF : JOURNAL_ERROR;
+    }
+
+    switch (type) {
+        case JOURNAL_GAME:
+            if (get(game.areaX) && get(game.areaY) && get(game.redCount) && get(game.greenCount)
+                && get(game.seed) && getTanks(game.tanks)) {
+                recordEnd = (uint64_t) in.tellg();
+                return JOURNAL_GAME;
+            }
+            break;
+
+        case JOURNAL_ROUND: {
+            uint32_t count;
+            if (!get(round.round) || !get(count) || count > MAX_RECORD_ITEMS) {
+                break;
+            }
+            round.actions.resize(count);
+            for (JournalAction & action : round.actions) {
+                if (!get(action.tankId) || !get(action.action)) {
+                    return JOURNAL_ERROR;
+                }
+            }
+            recordEnd = (uint64_t) in.tellg();
+            return JOURNAL_ROUND;
+        }
+
+        case JOURNAL_END:
+            if (get(end.rounds) && getTanks(end.tanks)) {
+                recordEnd = (uint64_t) in.tellg();
+                return JOURNAL_END;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return JOURNAL_ERROR;
+}
+
+bool JournalReader::getTanks(std::vector<JournalTank> & tanks)
+{
+    uint32_t count;
+    if (!get(count) || count > MAX_RECORD_ITEMS) {
+        return false;
+    }
+    tanks.resize(count);
+    for (JournalTank & tank : tanks) {
+        if (!get(tank.id) || !get(tank.x) || !get(tank.y) || !get(tank.team)) {
+            return false;
+        }
+    }
+    return true;
+}
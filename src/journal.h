@@ -0,0 +1,123 @@
+#ifndef INTERNET_OF_TANKS_JOURNAL_H
+#define INTERNET_OF_TANKS_JOURNAL_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Type of journal record
+ */
+enum JournalRecord
+{
+    JOURNAL_ERROR = -1,     //<< journal is corrupted
+    JOURNAL_EOF = 0,
+    JOURNAL_GAME = 1,       //<< new game was initialized
+    JOURNAL_ROUND = 2,      //<< actions applied in one round
+    JOURNAL_END = 3         //<< final state of the game
+};
+
+struct JournalTank
+{
+    uint32_t id;
+    int32_t x;
+    int32_t y;
+    uint8_t team;
+};
+
+struct JournalAction
+{
+    uint32_t tankId;
+    uint8_t action;
+};
+
+struct JournalGame
+{
+    int32_t areaX;
+    int32_t areaY;
+    int32_t redCount;
+    int32_t greenCount;
+    uint32_t seed;
+    std::vector<JournalTank> tanks;     //<< initial placement, tank id is index into this vector
+};
+
+struct JournalRound
+{
+    uint32_t round;
+    std::vector<JournalAction> actions; //<< only actions which do something
+};
+
+struct JournalEnd
+{
+    uint32_t rounds;
+    std::vector<JournalTank> tanks;     //<< tanks alive at the end, ordered by id
+};
+
+/**
+ * Append-only binary journal of games, used for deterministic replay
+ */
+class JournalWriter
+{
+public:
+
+    /**
+     * Open journal for appending, an existing journal is continued after its last complete record
+     * @throw runtime_error if journal cannot be created or the existing file is not a journal
+     */
+    JournalWriter(const std::string & path);
+
+    void writeGame(const JournalGame & game);
+
+    void writeRound(const JournalRound & round);
+
+    void writeEnd(const JournalEnd & end);
+
+private:
+    std::ofstream out;
+
+    template<typename T>
+    void put(T value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof value);
+    }
+
+    void putTanks(const std::vector<JournalTank> & tanks);
+};
+
+class JournalReader
+{
+public:
+
+    /**
+     * @throw runtime_error if journal cannot be opened or has wrong header
+     */
+    JournalReader(const std::string & path);
+
+    /**
+     * Read next record into the structure of its type
+     */
+    JournalRecord read(JournalGame & game, JournalRound & round, JournalEnd & end);
+
+    /**
+     * Get offset after the last record which was read completely
+     */
+    uint64_t position() const
+    {
+        return recordEnd;
+    }
+
+private:
+    std::ifstream in;
+    uint64_t recordEnd;
+
+    template<typename T>
+    bool get(T & value)
+    {
+        return (bool) in.read(reinterpret_cast<char*>(&value), sizeof value);
+    }
+
+    bool getTanks(std::vector<JournalTank> & tanks);
+};
+
+#endif //INTERNET_OF_TANKS_JOURNAL_H
@@ -0,0 +1,204 @@
+#include "pipeline.h"
+#include "eventlog.h"
+#include "trace.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+using std::runtime_error;
+
+static const size_t PACKET_QUEUE_SIZE = 16384;
+
+static void waitSemaphore(sem_t *semaphore)
+{
+    while (sem_wait(semaphore) == -1 && errno == EINTR) {
+    }
+}
+
+std::string boardHeader(int areaX, int areaY, uint64_t hash)
+{
+    char header[64];
+    snprintf(header, sizeof header, "%d,%d,%016" PRIx64 ",", areaX, areaY, hash);
+    return header;
+}
+
+RoundPipeline::RoundPipeline(int sd_listen, std::ofstream & namedPipe, int areaX, int areaY, RoundStats & stats)
+    : sd_listen(sd_listen), namedPipe(namedPipe), areaX(areaX), areaY(areaY), stats(stats), packets(PACKET_QUEUE_SIZE),
+      worldWaiting(false), frame(nullptr), freeFrames(2), fullFrames(2), ingestThread(nullptr), publishThread(nullptr)
+{
+    if (sd_listen == -1) {
+        throw runtime_error("Creating pipeline failed: world has no socket");
+    }
+    if (pipe(stopPipe) == -1) {
+        syslog(LOG_ERR, "pipe() failed: %s", strerror(errno));
+        throw runtime_error("Creating pipeline failed");
+    }
+    if (sem_init(&freeSem, 0, 2) == -1 || sem_init(&fullSem, 0, 0) == -1) {
+        syslog(LOG_ERR, "sem_init() failed: %s", strerror(errno));
+        close(stopPipe[0]);
+        close(stopPipe[1]);
+        throw runtime_error("Creating pipeline failed");
+    }
+    for (BoardFrame & board : frames) {
+        board.cells.resize((size_t) areaX * areaY);
+        freeFrames.push(&board);
+    }
+
+    try {
+        ingestThread = new std::thread(&RoundPipeline::ingestFnc, this);
+        publishThread = new std::thread(&RoundPipeline::publishFnc, this);
+    } catch (std::system_error & error) {
+        syslog(LOG_ERR, "Creating pipeline thread failed: %s", error.what());
+        close(stopPipe[1]);
+        if (ingestThread != nullptr) {
+            ingestThread->join();
+            delete ingestThread;
+        }
+        close(stopPipe[0]);
+        sem_destroy(&freeSem);
+        sem_destroy(&fullSem);
+        throw runtime_error("Creating pipeline failed");
+    }
+}
+
+RoundPipeline::~RoundPipeline()
+{
+    close(stopPipe[1]);
+    if (ingestThread != nullptr) {
+        ingestThread->join();
+        delete ingestThread;
+    }
+
+    // Publish thread stops when it finds no frame after the last post
+    sem_post(&fullSem);
+    if (publishThread != nullptr) {
+        publishThread->join();
+        delete publishThread;
+    }
+
+    close(stopPipe[0]);
+    sem_destroy(&freeSem);
+    sem_destroy(&fullSem);
+}
+
+BoardFrame & RoundPipeline::acquireFrame()
+{
+    if (sem_trywait(&freeSem) == -1) {
+        TraceSpan span("waitForPublish", "round");
+        waitSemaphore(&freeSem);
+    }
+    freeFrames.pop(frame);
+    frame->echoes.clear();
+    return *frame;
+}
+
+void RoundPipeline::publishFrame()
+{
+    fullFrames.push(frame);
+    frame = nullptr;
+    sem_post(&fullSem);
+}
+
+void RoundPipeline::ingestFnc()
+{
+    Trace::setThreadName("ingest");
+    struct pollfd fds[2];
+    fds[0].fd = sd_listen;
+    fds[0].events = POLLIN;
+    fds[1].fd = stopPipe[0];
+    fds[1].events = POLLIN;
+
+    ClientPacket packet;
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_ERR, "poll() failed: %s", strerror(errno));
+            return;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+
+        // Packets which do not fit into the queue wait in socket until world takes some
+        while (!packets.isFull()) {
+            socklen_t fromlen = sizeof packet.from;
+            if (recvfrom(sd_listen, packet.command, 2, MSG_DONTWAIT, (struct sockaddr *) &packet.from, &fromlen) == -1) {
+                if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR) {
+                    syslog(LOG_ERR, "recvfrom() failed: %s", strerror(errno));
+                }
+                break;
+            }
+            packets.push(packet);
+        }
+
+        // Fences pair with waitForPacket: either world sees the packets or ingest thread sees it waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (worldWaiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(packetMutex);
+            packetArrived.notify_one();
+        }
+        if (packets.isFull()) {
+            usleep(1000);
+        }
+    }
+}
+
+bool RoundPipeline::waitForPacket(RoundStats::Clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(packetMutex);
+    worldWaiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool arrived = packetArrived.wait_until(lock, deadline, [this] {
+        return !packets.isEmpty();
+    });
+    worldWaiting.store(false, std::memory_order_relaxed);
+    return arrived;
+}
+
+void RoundPipeline::publishFnc()
+{
+    Trace::setThreadName("publish");
+    std::string text;
+
+    while (true) {
+        waitSemaphore(&fullSem);
+        BoardFrame *published;
+        if (!fullFrames.pop(published)) {
+            return;
+        }
+
+        RoundStats::Clock::time_point start = RoundStats::Clock::now();
+        for (const ClientPacket & echo : published->echoes) {
+            if (sendto(sd_listen, echo.command, 2, 0, (struct sockaddr *) &echo.from, sizeof echo.from) == -1) {
+                syslog(LOG_ERR, "sendto() failed: %s", strerror(errno));
+            }
+        }
+
+        EventLog::log(LOG_INFO, BOARD_PRINTED, published->round);
+        text = boardHeader(areaX, areaY, published->hash);
+        for (char cell : published->cells) {
+            text += cell;
+            text += ',';
+        }
+        namedPipe.write(text.data(), text.size());
+        namedPipe.flush();
+
+        RoundStats::Clock::time_point printed = RoundStats::Clock::now();
+        stats.recordPhase(PHASE_PRINT, printed - start);
+        Trace::span("publish", "publish", start, printed);
+
+        freeFrames.push(published);
+        sem_post(&freeSem);
+    }
+}
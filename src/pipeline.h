@@ -0,0 +1,128 @@
+#ifndef INTERNET_OF_TANKS_PIPELINE_H
+#define INTERNET_OF_TANKS_PIPELINE_H
+
+#include "spscqueue.h"
+#include "stats.h"
+
+#include <netinet/in.h>
+#include <semaphore.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Packet received from tankclient
+ */
+struct ClientPacket
+{
+    struct sockaddr_in from;
+    char command[2];
+};
+
+/**
+ * Result of one round handed to the publish stage
+ */
+struct BoardFrame
+{
+    unsigned int round;
+    uint64_t hash;                      //<< zobrist hash of gameboard, see engine::hash
+    std::vector<char> cells;            //<< 'g', 'r' or '0' of every field in row-major order
+    std::vector<ClientPacket> echoes;   //<< accepted commands sent back to their clients
+};
+
+/**
+ * Header of frame printed into pipe "<X>,<Y>,<hash>," with hash of gameboard in 16 hex digits,
+ * it is followed by "<c>," for every field
+ */
+std::string boardHeader(int areaX, int areaY, uint64_t hash);
+
+/**
+ * Stages of pipelined round running on their own threads. Ingest thread receives packets of the
+ * next round while world resolves the current round, publish thread prints gameboard and sends
+ * echoes of the previous round. Stages hand off through lock-free queues and the gameboard is
+ * double buffered, so world waits only when publishing is two frames behind.
+ */
+class RoundPipeline
+{
+public:
+
+    /**
+     * Start ingest and publish threads
+     * @param namedPipe is written only by the publish thread while the pipeline exists
+     * @param stats PHASE_PRINT is recorded by the publish thread
+     * @throw runtime_error if threads cannot be started
+     */
+    RoundPipeline(int sd_listen, std::ofstream & namedPipe, int areaX, int areaY, RoundStats & stats);
+
+    /**
+     * Publish remaining frames and stop threads
+     */
+    virtual ~RoundPipeline();
+
+    /**
+     * Take packet received by ingest thread
+     * @return false if there is no packet
+     */
+    bool receive(ClientPacket & packet)
+    {
+        return packets.pop(packet);
+    }
+
+    /**
+     * Check if ingest thread has received a packet which was not taken yet
+     */
+    bool hasPacket() const
+    {
+        return !packets.isEmpty();
+    }
+
+    /**
+     * Block until ingest thread receives a packet or until deadline
+     * @return true if a packet is waiting
+     */
+    bool waitForPacket(RoundStats::Clock::time_point deadline);
+
+    /**
+     * Get empty frame for the current round, waits while both frames are being published
+     */
+    BoardFrame & acquireFrame();
+
+    /**
+     * Hand the acquired frame to the publish thread
+     */
+    void publishFrame();
+
+private:
+    int sd_listen;
+    std::ofstream & namedPipe;
+    int areaX;
+    int areaY;
+    RoundStats & stats;
+
+    SpscQueue<ClientPacket> packets;    //<< from ingest thread to world
+    std::mutex packetMutex;
+    std::condition_variable packetArrived;  //<< notified by ingest thread while world waits for packets
+    std::atomic_bool worldWaiting;
+    BoardFrame frames[2];
+    BoardFrame *frame;                  //<< acquired by world
+    SpscQueue<BoardFrame *> freeFrames; //<< from publish thread to world
+    SpscQueue<BoardFrame *> fullFrames; //<< from world to publish thread
+    sem_t freeSem;                      //<< counts freeFrames
+    sem_t fullSem;                      //<< counts fullFrames, posted once more to stop
+
+    int stopPipe[2];                    //<< closing write end stops ingest thread
+    std::thread *ingestThread;
+    std::thread *publishThread;
+
+    void ingestFnc();
+
+    void publishFnc();
+};
+
+#endif //INTERNET_OF_TANKS_PIPELINE_H
@@ -0,0 +1,43 @@
+#include "ratelimit.h"
+
+#include <algorithm>
+
+TokenBuckets::TokenBuckets()
+    : rate(0), burst(0)
+{
+}
+
+void TokenBuckets::setRate(double rate, double burst)
+{
+    this->rate = rate;
+    this->burst = std::max(1.0, burst);
+}
+
+void TokenBuckets::reset(uint32_t id, Clock::time_point now)
+{
+    if (id >= tokens.size()) {
+        tokens.resize((size_t) id + 1);
+        updated.resize((size_t) id + 1);
+    }
+    tokens[id] = burst;
+    updated[id] = now;
+}
+
+bool TokenBuckets::take(uint32_t id, Clock::time_point now)
+{
+    if (rate <= 0) {
+        return true;
+    }
+    if (id >= tokens.size()) {
+        reset(id, now);
+    }
+
+    double elapsed = std::chrono::duration<double>(now - updated[id]).count();
+    tokens[id] = std::min(burst, tokens[id] + elapsed * rate);
+    updated[id] = now;
+    if (tokens[id] < 1) {
+        return false;
+    }
+    tokens[id] -= 1;
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef INTERNET_OF_TANKS_RATELIMIT_H
+#define INTERNET_OF_TANKS_RATELIMIT_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Token buckets limiting commands of clients, one bucket per tank id. Bucket of a client holds
+ * up to burst tokens, it is refilled by rate tokens per second and every command takes one token.
+ */
+class TokenBuckets
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Create buckets which do not limit anything
+     */
+    TokenBuckets();
+
+    /**
+     * @param rate commands per second of one client, 0 means unlimited
+     * @param burst commands which a client can send at once after being silent
+     */
+    void setRate(double rate, double burst);
+
+    bool isLimited() const
+    {
+        return rate > 0;
+    }
+
+    /**
+     * Give full bucket to the client which was bound to tank
+     */
+    void reset(uint32_t id, Clock::time_point now);
+
+    /**
+     * Take one token from bucket of tank
+     * @return false if the bucket is empty and the command has to be ignored
+     */
+    bool take(uint32_t id, Clock::time_point now);
+
+private:
+    double rate;
+    double burst;
+    std::vector<double> tokens;
+    std::vector<Clock::time_point> updated;     //<< when tokens were refilled last time
+};
+
+#endif //INTERNET_OF_TANKS_RATELIMIT_H
@@ -0,0 +1,201 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using std::runtime_error;
+
+static const char SNAPSHOT_MAGIC[4] = {'I', 'O', 'T', 'S'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+static uint64_t checksum(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    const uint8_t *bytes = (const uint8_t *) data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/**
+ * Read exactly size bytes
+ * @return false on error or end of file
+ */
+static bool readFully(int fd, void *data, size_t size)
+{
+    char *position = (char *) data;
+    while (size > 0) {
+        ssize_t count = read(fd, position, size);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        position += count;
+        size -= (size_t) count;
+    }
+    return true;
+}
+
+void writeSnapshot(const std::string & path, const WorldSnapshot & snapshot)
+{
+    size_t tanksSize = snapshot.tanks.size() * sizeof(SnapshotTank);
+    size_t freeSize = snapshot.freeTanks.size() * sizeof(uint32_t);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+    header.version = SNAPSHOT_VERSION;
+    header.areaX = snapshot.areaX;
+    header.areaY = snapshot.areaY;
+    header.redCount = snapshot.redCount;
+    header.greenCount = snapshot.greenCount;
+    header.seed = snapshot.seed;
+    header.round = snapshot.round;
+    header.tankCount = (uint32_t) snapshot.tanks.size();
+    header.freeCount = (uint32_t) snapshot.freeTanks.size();
+    header.checksum = checksum(snapshot.freeTanks.data(), freeSize, checksum(snapshot.tanks.data(), tanksSize));
+
+    std::string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        syslog(LOG_ERR, "open() of snapshot %s failed: %s", tmpPath.c_str(), strerror(errno));
+        throw runtime_error("Creating snapshot failed");
+    }
+
+    struct iovec parts[3] = {
+        {&header, sizeof header},
+        {(void *) snapshot.tanks.data(), tanksSize},
+        {(void *) snapshot.freeTanks.data(), freeSize}
+    };
+    struct iovec *part = parts;
+    int partCount = 3;
+    while (partCount > 0) {
+        ssize_t written = writev(fd, part, partCount);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            syslog(LOG_ERR, "writev() of snapshot %s failed: %s", tmpPath.c_str(), strerror(errno));
+            close(fd);
+            unlink(tmpPath.c_str());
+            throw runtime_error("Writing snapshot failed");
+        }
+        // Skip what was written, writev may stop in the middle of a part
+        while (partCount > 0 && (size_t) written >= part->iov_len) {
+            written -= part->iov_len;
+            part++;
+            partCount--;
+        }
+        if (partCount > 0) {
+            part->iov_base = (char *) part->iov_base + written;
+            part->iov_len -= written;
+        }
+    }
+
+    if (fsync(fd) == -1 || close(fd) == -1) {
+        syslog(LOG_ERR, "fsync() of snapshot %s failed: %s", tmpPath.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        throw runtime_error("Writing snapshot failed");
+    }
+    if (rename(tmpPath.c_str(), path.c_str()) == -1) {
+        syslog(LOG_ERR, "rename() of snapshot %s failed: %s", tmpPath.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        throw runtime_error("Writing snapshot failed");
+    }
+}
+
+WorldSnapshot readSnapshot(const std::string & path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        syslog(LOG_ERR, "open() of snapshot %s failed: %s", path.c_str(), strerror(errno));
+        throw runtime_error("Opening snapshot failed");
+    }
+
+    WorldSnapshot snapshot;
+    SnapshotHeader header;
+    struct stat info;
+    bool valid = fstat(fd, &info) == 0 && readFully(fd, &header, sizeof header)
+                 && memcmp(header.magic, SNAPSHOT_MAGIC, sizeof header.magic) == 0
+                 && header.version == SNAPSHOT_VERSION
+                 && (uint64_t) info.st_size == sizeof header + (uint64_t) header.tankCount * sizeof(SnapshotTank)
+                                               + (uint64_t) header.freeCount * sizeof(uint32_t);
+    if (valid) {
+        snapshot.tanks.resize(header.tankCount);
+        snapshot.freeTanks.resize(header.freeCount);
+        valid = readFully(fd, snapshot.tanks.data(), snapshot.tanks.size() * sizeof(SnapshotTank))
+                && readFully(fd, snapshot.freeTanks.data(), snapshot.freeTanks.size() * sizeof(uint32_t))
+                && header.checksum == checksum(snapshot.freeTanks.data(), snapshot.freeTanks.size() * sizeof(uint32_t),
+                                               checksum(snapshot.tanks.data(), snapshot.tanks.size() * sizeof(SnapshotTank)));
+    }
+    close(fd);
+
+    if (!valid) {
+        syslog(LOG_ERR, "snapshot %s is corrupted", path.c_str());
+        throw runtime_error("Snapshot is corrupted");
+    }
+
+    snapshot.areaX = header.areaX;
+    snapshot.areaY = header.areaY;
+    snapshot.redCount = header.redCount;
+    snapshot.greenCount = header.greenCount;
+    snapshot.seed = header.seed;
+    snapshot.round = header.round;
+    return snapshot;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string & path)
+    : path(path), hasPending(false), stopping(false)
+{
+    thread = std::thread(&SnapshotWriter::threadFnc, this);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    {
+        std::unique_lock<std::mutex> uniqueLock(mtx);
+        stopping = true;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+void SnapshotWriter::submit(WorldSnapshot && snapshot)
+{
+    {
+        std::unique_lock<std::mutex> uniqueLock(mtx);
+        pending = std::move(snapshot);
+        hasPending = true;
+    }
+    cv.notify_one();
+}
+
+void SnapshotWriter::threadFnc()
+{
+    std::unique_lock<std::mutex> uniqueLock(mtx);
+    while (true) {
+        cv.wait(uniqueLock, [this] { return stopping || hasPending; });
+        if (!hasPending) {
+            return;
+        }
+
+        WorldSnapshot snapshot = std::move(pending);
+        hasPending = false;
+        uniqueLock.unlock();
+        try {
+            writeSnapshot(path, snapshot);
+        } catch (runtime_error & error) {
+            // Logged by writeSnapshot, the next snapshot is tried again
+        }
+        uniqueLock.lock();
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef INTERNET_OF_TANKS_SNAPSHOT_H
+#define INTERNET_OF_TANKS_SNAPSHOT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Binary snapshot of a running world used for warm restarts.
+ *
+ * The file is a header followed by an array of tanks and an array of ids of free tanks. Arrays are
+ * written and read by one system call each, so saving and restoring is bounded by I/O bandwidth.
+ * The snapshot is written into a temporary file which is renamed over the previous snapshot,
+ * so a crash during writing never destroys the last complete snapshot.
+ */
+
+enum SnapshotTankFlags : uint8_t
+{
+    SNAPSHOT_ON_BOARD = 1,      //<< tank is on gameboard, otherwise it is destroyed
+    SNAPSHOT_BOUND = 2          //<< tank is controlled by client with addr and port
+};
+
+struct SnapshotHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t areaX;
+    int32_t areaY;
+    int32_t redCount;
+    int32_t greenCount;
+    uint32_t seed;
+    uint32_t round;
+    uint32_t tankCount;
+    uint32_t freeCount;
+    uint64_t checksum;          //<< FNV-1a of both arrays
+};
+
+struct SnapshotTank
+{
+    uint32_t id;
+    int32_t x;
+    int32_t y;
+    uint8_t team;
+    uint8_t flags;              //<< SnapshotTankFlags
+    uint16_t port;              //<< network byte order
+    uint32_t addr;              //<< IPv4 address in network byte order
+};
+
+struct WorldSnapshot
+{
+    int32_t areaX;
+    int32_t areaY;
+    int32_t redCount;
+    int32_t greenCount;
+    uint32_t seed;
+    uint32_t round;
+    std::vector<SnapshotTank> tanks;    //<< tanks on gameboard and destroyed tanks bound to clients
+    std::vector<uint32_t> freeTanks;    //<< ids of tanks waiting for client, in order of assignment from the back
+};
+
+/**
+ * Write snapshot atomically
+ * @throw runtime_error if writing fails, previous snapshot is kept
+ */
+void writeSnapshot(const std::string & path, const WorldSnapshot & snapshot);
+
+/**
+ * @throw runtime_error if snapshot cannot be read or is corrupted
+ */
+WorldSnapshot readSnapshot(const std::string & path);
+
+/**
+ * Background thread writing snapshots. Snapshot submitted while previous one is being written waits,
+ * newer submitted snapshot replaces it, so the round thread never waits for the disk.
+ */
+class SnapshotWriter
+{
+public:
+
+    SnapshotWriter(const std::string & path);
+
+    /**
+     * Write pending snapshot and stop the thread
+     */
+    ~SnapshotWriter();
+
+    void submit(WorldSnapshot && snapshot);
+
+private:
+    std::string path;
+    std::thread thread;
+    std::mutex mtx;
+    std::condition_variable cv;
+    WorldSnapshot pending;
+    bool hasPending;
+    bool stopping;
+
+    void threadFnc();
+};
+
+#endif //INTERNET_OF_TANKS_SNAPSHOT_H
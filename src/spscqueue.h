@@ -0,0 +1,81 @@
+#ifndef INTERNET_OF_TANKS_SPSCQUEUE_H
+#define INTERNET_OF_TANKS_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Bounded lock-free queue with one producer thread and one consumer thread. Capacity is rounded
+ * up to a power of two. Neither push nor pop ever blocks.
+ */
+template <typename T>
+class SpscQueue
+{
+public:
+
+    explicit SpscQueue(size_t capacity)
+        : head(0), tail(0)
+    {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        items.resize(size);
+        mask = size - 1;
+    }
+
+    /**
+     * Called by producer
+     * @return false if the queue is full
+     */
+    bool push(const T & item)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        if (position - head.load(std::memory_order_acquire) == items.size()) {
+            return false;
+        }
+        items[position & mask] = item;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Called by consumer
+     * @return false if the queue is empty
+     */
+    bool pop(T & item)
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        if (position == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[position & mask];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Called by consumer
+     */
+    bool isEmpty() const
+    {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Called by producer
+     */
+    bool isFull() const
+    {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == items.size();
+    }
+
+private:
+    std::vector<T> items;
+    size_t mask;
+    std::atomic<size_t> head;   //<< next item popped by consumer
+    std::atomic<size_t> tail;   //<< next item pushed by producer
+};
+
+#endif //INTERNET_OF_TANKS_SPSCQUEUE_H
@@ -0,0 +1,378 @@
+#include "stats.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syslog.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+static const char *PHASE_NAMES[PHASE_COUNT] = {
+    "receive", "fire", "move", "print", "sleep", "tick", "stragglers"
+};
+
+static const char *COUNTER_NAMES[COUNTER_COUNT] = {
+    "packets", "actions", "tank_hits", "tank_crashes", "tank_roll_offs", "packets_dropped", "packets_throttled",
+    "ingest_deferred_rounds", "early_commits", "expired_sessions", "packets_inbox_full"
+};
+
+static const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+Histogram::Histogram()
+    : total(0), sum(0)
+{
+    for (auto & count : counts) {
+        count = 0;
+    }
+}
+
+int Histogram::bucketIndex(uint64_t value)
+{
+    if (value < (uint64_t) SUB_BUCKETS) {
+        return (int) value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= MAX_BITS) {
+        return BUCKET_COUNT - 1;
+    }
+    int subBucket = (int) (value >> (msb - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+    return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + subBucket;
+}
+
+uint64_t Histogram::bucketLowerBound(int index)
+{
+    if (index < SUB_BUCKETS) {
+        return (uint64_t) index;
+    }
+    int msb = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t subBucket = (uint64_t) (index % SUB_BUCKETS);
+    return (SUB_BUCKETS + subBucket) << (msb - SUB_BUCKET_BITS);
+}
+
+uint64_t Histogram::count() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::getSum() const
+{
+    return sum.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::countAtMost(uint64_t value) const
+{
+    // Bucket is counted only if all its values are at most value
+    uint64_t result = 0;
+    for (int i = 0; i < BUCKET_COUNT - 1 && bucketLowerBound(i + 1) <= value + 1; i++) {
+        result += counts[i].load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+uint64_t Histogram::valueAtQuantile(double quantile) const
+{
+    uint64_t all = 0;
+    for (auto & count : counts) {
+        all += count.load(std::memory_order_relaxed);
+    }
+    if (all == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t) (quantile * all);
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT - 1; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return bucketLowerBound(i + 1) - 1;
+        }
+    }
+    return bucketLowerBound(BUCKET_COUNT - 1);
+}
+
+RoundStats::RoundStats()
+    : rounds(0), overruns(0)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        current[i] = 0;
+        lastRound[i] = 0;
+        totals[i] = 0;
+    }
+}
+
+void RoundStats::finishRound(bool overrun)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        lastRound[i].store(current[i], std::memory_order_relaxed);
+        totals[i].fetch_add(current[i], std::memory_order_relaxed);
+        current[i] = 0;
+    }
+    rounds.fetch_add(1, std::memory_order_relaxed);
+    if (overrun) {
+        overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::string RoundStats::toPrometheus() const
+{
+    return toPrometheus(std::vector<const RoundStats*>(1, this));
+}
+
+std::string RoundStats::toPrometheus(const std::vector<const RoundStats*> & arenas)
+{
+    std::string out;
+    char line[256];
+    std::vector<std::string> labels;    //<< label of arena followed by comma, empty for single world
+    for (size_t i = 0; i < arenas.size(); i++) {
+        labels.push_back(arenas.size() > 1 ? "arena=\"" + std::to_string(i) + "\"," : "");
+    }
+
+    out += "# HELP iot_round_phase_seconds Duration of round phases.\n";
+    out += "# TYPE iot_round_phase_seconds histogram\n";
+    for (size_t i = 0; i < arenas.size(); i++) {
+        const char *label = labels[i].c_str();
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            const Histogram & histogram = arenas[i]->phases[phase];
+
+            // Buckets from 1 us to 8 s, two per power of two
+            for (int bits = 10; bits <= 33; bits++) {
+                uint64_t bounds[2] = { 1ULL << bits, 3ULL << (bits - 1) };
+                for (uint64_t bound : bounds) {
+                    snprintf(line, sizeof line, "iot_round_phase_seconds_bucket{%sphase=\"%s\",le=\"%.9g\"} %llu\n",
+                             label, PHASE_NAMES[phase], bound / 1e9, (unsigned long long) histogram.countAtMost(bound));
+                    out += line;
+                }
+            }
+            uint64_t count = histogram.count();
+            snprintf(line, sizeof line, "iot_round_phase_seconds_bucket{%sphase=\"%s\",le=\"+Inf\"} %llu\n",
+                     label, PHASE_NAMES[phase], (unsigned long long) count);
+            out += line;
+            snprintf(line, sizeof line, "iot_round_phase_seconds_sum{%sphase=\"%s\"} %.9g\n",
+                     label, PHASE_NAMES[phase], histogram.getSum() / 1e9);
+            out += line;
+            snprintf(line, sizeof line, "iot_round_phase_seconds_count{%sphase=\"%s\"} %llu\n",
+                     label, PHASE_NAMES[phase], (unsigned long long) count);
+            out += line;
+        }
+    }
+
+    out += "# HELP iot_round_phase_quantile_seconds Quantiles of round phase durations since start.\n";
+    out += "# TYPE iot_round_phase_quantile_seconds gauge\n";
+    for (size_t i = 0; i < arenas.size(); i++) {
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            for (double quantile : QUANTILES) {
+                snprintf(line, sizeof line, "iot_round_phase_quantile_seconds{%sphase=\"%s\",quantile=\"%g\"} %.9g\n",
+                         labels[i].c_str(), PHASE_NAMES[phase], quantile,
+                         arenas[i]->phases[phase].valueAtQuantile(quantile) / 1e9);
+                out += line;
+            }
+        }
+    }
+
+    // Metrics without other labels get label of arena alone
+    for (std::string & label : labels) {
+        if (!label.empty()) {
+            label = "{" + label.substr(0, label.size() - 1) + "}";
+        }
+    }
+
+    out += "# HELP iot_rounds_total Number of performed rounds.\n";
+    out += "# TYPE iot_rounds_total counter\n";
+    for (size_t i = 0; i < arenas.size(); i++) {
+        snprintf(line, sizeof line, "iot_rounds_total%s %llu\n",
+                 labels[i].c_str(), (unsigned long long) arenas[i]->rounds.load());
+        out += line;
+    }
+
+    out += "# HELP iot_round_overruns_total Number of rounds which took longer than the round time.\n";
+    out += "# TYPE iot_round_overruns_total counter\n";
+    for (size_t i = 0; i < arenas.size(); i++) {
+        snprintf(line, sizeof line, "iot_round_overruns_total%s %llu\n",
+                 labels[i].c_str(), (unsigned long long) arenas[i]->overruns.load());
+        out += line;
+    }
+
+    for (int counter = 0; counter < COUNTER_COUNT; counter++) {
+        snprintf(line, sizeof line, "# TYPE iot_%s_total counter\n", COUNTER_NAMES[counter]);
+        out += line;
+        for (size_t i = 0; i < arenas.size(); i++) {
+            snprintf(line, sizeof line, "iot_%s_total%s %llu\n", COUNTER_NAMES[counter], labels[i].c_str(),
+                     (unsigned long long) arenas[i]->totals[counter].load());
+            out += line;
+        }
+        snprintf(line, sizeof line, "# TYPE iot_last_round_%s gauge\n", COUNTER_NAMES[counter]);
+        out += line;
+        for (size_t i = 0; i < arenas.size(); i++) {
+            snprintf(line, sizeof line, "iot_last_round_%s%s %llu\n", COUNTER_NAMES[counter], labels[i].c_str(),
+                     (unsigned long long) arenas[i]->lastRound[counter].load());
+            out += line;
+        }
+    }
+
+    return out;
+}
+
+StatsServer::StatsServer(const RoundStats & stats, const std::string & address,
+                         unsigned long (*droppedLogRecords)())
+    : StatsServer(std::vector<const RoundStats*>(1, &stats), address, droppedLogRecords)
+{
+}
+
+StatsServer::StatsServer(const std::vector<const RoundStats*> & stats, const std::string & address,
+                         unsigned long (*droppedLogRecords)())
+    : stats(stats), droppedLogRecords(droppedLogRecords), sd_listen(-1), thread(nullptr)
+{
+    if (pipe(stopPipe) == -1) {
+        syslog(LOG_ERR, "pipe() failed: %s", strerror(errno));
+        throw std::runtime_error("Creating stats server failed");
+    }
+
+    try {
+        setListenSocket(address);
+        thread = new std::thread(&StatsServer::serveFnc, this);
+    } catch (std::exception & error) {
+        if (sd_listen != -1) {
+            close(sd_listen);
+        }
+        close(stopPipe[0]);
+        close(stopPipe[1]);
+        throw std::runtime_error(std::string("Creating stats server failed: ") + error.what());
+    }
+}
+
+StatsServer::~StatsServer()
+{
+    close(stopPipe[1]);
+    thread->join();
+    delete thread;
+
+    close(stopPipe[0]);
+    close(sd_listen);
+    if (!unixPath.empty()) {
+        unlink(unixPath.c_str());
+    }
+}
+
+void StatsServer::setListenSocket(const std::string & address)
+{
+    if (!address.empty() && (address[0] == '/' || address[0] == '.')) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof addr.sun_path) {
+            throw std::runtime_error("unix socket path is too long");
+        }
+        strcpy(addr.sun_path, address.c_str());
+
+        if ((sd_listen = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            syslog(LOG_ERR, "socket() failed: %s", strerror(errno));
+            throw std::runtime_error("socket() failed");
+        }
+        unlink(address.c_str());
+        if (bind(sd_listen, (struct sockaddr*) &addr, sizeof addr) == -1) {
+            syslog(LOG_ERR, "bind() of %s failed: %s", address.c_str(), strerror(errno));
+            throw std::runtime_error("bind() failed");
+        }
+        unixPath = address;
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((uint16_t) atoi(address.c_str()));
+
+        if ((sd_listen = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+            syslog(LOG_ERR, "socket() failed: %s", strerror(errno));
+            throw std::runtime_error("socket() failed");
+        }
+        int yes = 1;
+        setsockopt(sd_listen, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+        if (bind(sd_listen, (struct sockaddr*) &addr, sizeof addr) == -1) {
+            syslog(LOG_ERR, "bind() of port %s failed: %s", address.c_str(), strerror(errno));
+            throw std::runtime_error("bind() failed");
+        }
+    }
+
+    if (listen(sd_listen, 16) == -1) {
+        syslog(LOG_ERR, "listen() failed: %s", strerror(errno));
+        throw std::runtime_error("listen() failed");
+    }
+}
+
+void StatsServer::serveFnc()
+{
+    struct pollfd fds[2];
+    fds[0].fd = sd_listen;
+    fds[0].events = POLLIN;
+    fds[1].fd = stopPipe[0];
+    fds[1].events = POLLIN;
+
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_ERR, "poll() failed: %s", strerror(errno));
+            return;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+
+        int sd_client = accept(sd_listen, NULL, NULL);
+        if (sd_client == -1) {
+            syslog(LOG_WARNING, "accept() failed: %s", strerror(errno));
+            continue;
+        }
+        serveClient(sd_client);
+        close(sd_client);
+    }
+}
+
+void StatsServer::serveClient(int sd_client)
+{
+    // Request itself does not matter, read it so that closing does not reset the connection
+    struct pollfd fd;
+    fd.fd = sd_client;
+    fd.events = POLLIN;
+    char request[4096];
+    if (poll(&fd, 1, 100) == 1) {
+        recv(sd_client, request, sizeof request, MSG_DONTWAIT);
+    }
+
+    std::string body = RoundStats::toPrometheus(stats);
+    if (droppedLogRecords != nullptr) {
+        body += "# HELP iot_log_dropped_records_total Log records dropped because a ring buffer was full.\n";
+        body += "# TYPE iot_log_dropped_records_total counter\n";
+        body += "iot_log_dropped_records_total " + std::to_string(droppedLogRecords()) + "\n";
+    }
+    std::string response = "HTTP/1.0 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "\r\n" + body;
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t ret_val = send(sd_client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (ret_val == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_WARNING, "send() of stats failed: %s", strerror(errno));
+            return;
+        }
+        sent += ret_val;
+    }
+}
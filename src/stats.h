@@ -0,0 +1,192 @@
+#ifndef INTERNET_OF_TANKS_STATS_H
+#define INTERNET_OF_TANKS_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Phases of one round measured by RoundStats
+ */
+enum RoundPhase
+{
+    PHASE_RECEIVE,      //<< receiving messages from tankclients
+    PHASE_FIRE,         //<< waiting for tank threads and resolving fire actions
+    PHASE_MOVE,         //<< resolving move actions
+    PHASE_PRINT,        //<< printing gameboard into pipe
+    PHASE_SLEEP,        //<< waiting for the end of round
+    PHASE_TICK,         //<< whole round except of sleep
+    PHASE_STRAGGLERS,   //<< lockstep waiting from the first submitted command to the end of round
+    PHASE_COUNT
+};
+
+/**
+ * Events counted by RoundStats
+ */
+enum RoundCounter
+{
+    COUNTER_PACKETS,
+    COUNTER_ACTIONS,
+    COUNTER_HITS,
+    COUNTER_CRASHES,
+    COUNTER_ROLL_OFFS,
+    COUNTER_DROPPED,        //<< packets of clients without tank on gameboard
+    COUNTER_THROTTLED,      //<< packets over rate of their client
+    COUNTER_DEFERRED,       //<< rounds which left packets for the next round because of ingestion budget
+    COUNTER_EARLY_COMMITS,  //<< lockstep rounds finished before deadline because all clients submitted
+    COUNTER_EXPIRED,        //<< client sessions expired after idle timeout
+    COUNTER_INBOX_FULL,     //<< packets for hosted arena dropped by its host because its inbox was full
+    COUNTER_COUNT
+};
+
+/**
+ * Histogram of durations in nanoseconds with logarithmic buckets, each power of two is split into
+ * 16 linear sub-buckets, so every value is stored with relative error under 7 %.
+ * Values are recorded by one thread and can be read by other threads.
+ */
+class Histogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_BITS = 40;     //<< longer durations are stored into the last bucket
+    static const int BUCKET_COUNT = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    Histogram();
+
+    void record(uint64_t value)
+    {
+        // Total first, so +Inf read after the buckets is never lower than a bucket
+        total.fetch_add(1, std::memory_order_relaxed);
+        counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const;
+
+    uint64_t getSum() const;
+
+    /**
+     * Get number of recorded values lower than or equal to value, as "le" bucket of Prometheus.
+     * Values of the last bucket are never counted, count() includes them.
+     */
+    uint64_t countAtMost(uint64_t value) const;
+
+    /**
+     * Get upper bound of the bucket where the quantile lies
+     */
+    uint64_t valueAtQuantile(double quantile) const;
+
+private:
+    std::atomic<uint64_t> counts[BUCKET_COUNT];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+
+    static int bucketIndex(uint64_t value);
+
+    static uint64_t bucketLowerBound(int index);
+};
+
+/**
+ * Latency of round phases and counters of game events
+ */
+class RoundStats
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    RoundStats();
+
+    void recordPhase(RoundPhase phase, Clock::duration duration)
+    {
+        phases[phase].record((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+
+    /**
+     * Count events of the current round. Must be called from thread which performs rounds.
+     */
+    void count(RoundCounter counter, uint64_t n = 1)
+    {
+        current[counter] += n;
+    }
+
+    /**
+     * Publish counters of the current round and start counting a new one
+     * @param overrun true if the round took longer than the round time
+     */
+    void finishRound(bool overrun);
+
+    /**
+     * Format all statistics in Prometheus text exposition format
+     */
+    std::string toPrometheus() const;
+
+    /**
+     * Format statistics of several arenas, series of every arena are labeled by its index
+     */
+    static std::string toPrometheus(const std::vector<const RoundStats*> & arenas);
+
+    const Histogram & getPhase(RoundPhase phase) const
+    {
+        return phases[phase];
+    }
+
+    uint64_t getTotal(RoundCounter counter) const
+    {
+        return totals[counter].load(std::memory_order_relaxed);
+    }
+
+private:
+    Histogram phases[PHASE_COUNT];
+    uint64_t current[COUNTER_COUNT];
+    std::atomic<uint64_t> lastRound[COUNTER_COUNT];
+    std::atomic<uint64_t> totals[COUNTER_COUNT];
+    std::atomic<uint64_t> rounds;
+    std::atomic<uint64_t> overruns;
+};
+
+/**
+ * Serve RoundStats to everybody who connects to a local socket. Response is a HTTP response
+ * with Prometheus text, so the endpoint can be scraped directly.
+ */
+class StatsServer
+{
+public:
+
+    /**
+     * Start serving thread
+     * @param address path of unix socket if it starts with '/' or '.', TCP port on localhost otherwise
+     * @param droppedLogRecords returns log records dropped by the process, not served if null
+     * @throw runtime_error if the socket cannot be created
+     */
+    StatsServer(const RoundStats & stats, const std::string & address,
+                unsigned long (*droppedLogRecords)() = nullptr);
+
+    /**
+     * Serve statistics of several arenas together
+     * @throw runtime_error if the socket cannot be created
+     */
+    StatsServer(const std::vector<const RoundStats*> & stats, const std::string & address,
+                unsigned long (*droppedLogRecords)() = nullptr);
+
+    virtual ~StatsServer();
+
+private:
+    std::vector<const RoundStats*> stats;
+    unsigned long (*droppedLogRecords)();
+    std::string unixPath;
+    int sd_listen;
+    int stopPipe[2];            //<< closing write end stops the thread
+    std::thread *thread;
+
+    void setListenSocket(const std::string & address);
+
+    void serveFnc();
+
+    void serveClient(int sd_client);
+};
+
+#endif //INTERNET_OF_TANKS_STATS_H
@@ -12,80 +12,93 @@
 #include <stdexcept>
 #include <thread>
 
-std::condition_variable Tank::actionCV;
-std::mutex Tank::actionMtx;
-
-Tank::Tank(const Team &team)
-    : team(team), action(UNDEFINED), actionBuffer{'n','o','n','o'}, sd_client(0), destroyed(false)
+Tank::Tank()
+    : notifyTime(0), actionTarget(nullptr), actionBuffer{'n','o','n','o'}, sd_client(0), destroyed(false)
 {
     currentAction = actionBuffer;
     if (sem_init(&readySem, 0, 0) == -1) {
         syslog(LOG_ERR, "sem_init() failed: %s", strerror(errno));
         throw std::runtime_error("Creating semaphore failed");
     }
+    if (sem_init(&actionSem, 0, 0) == -1) {
+        syslog(LOG_ERR, "sem_init() failed: %s", strerror(errno));
+        sem_destroy(&readySem);
+        throw std::runtime_error("Creating semaphore failed");
+    }
 
     try {
         thread = new std::thread(&Tank::threadFnc, this);
     } catch (std::system_error error) {
         syslog(LOG_ERR, "Creating tank thread failed: %s", error.what());
         sem_destroy(&readySem);
+        sem_destroy(&actionSem);
         throw error;
     }
 }
 
-bool Tank::isDestroyed() const
-{
-    return destroyed;
-}
-
 Tank* Tank::markAsDestroyed()
 {
     destroyed = true;
     return this;
 }
 
-const Action &Tank::getAction() const
+void Tank::notify(uint8_t *action)
 {
-    return action;
-}
-
-const Team &Tank::getTeam() const
-{
-    return team;
-}
-
-void Tank::notifyAllTanks()
-{
-    std::unique_lock<std::mutex> uniqueLock(actionMtx);
-    Tank::actionCV.notify_all();
+    // Semaphore orders the target before the tank thread reads it
+    actionTarget = action;
+    if (Trace::isEnabled()) {
+        notifyTime = Trace::Clock::now().time_since_epoch().count();
+    }
+    if (sem_post(&actionSem) != 0) {
+        syslog(LOG_WARNING, "sem_post() failed: %s", strerror(errno));
+    }
 }
 
 void Tank::threadFnc()
 {
-    std::unique_lock<std::mutex> uniqueLock(actionMtx, std::defer_lock);
-
-    while (!destroyed) {
+    Trace::setThreadName("tank");
 
-        uniqueLock.lock();
+    // Ready semaphore is posted after every action, also after the last one of a tank destroyed
+    // during the round, otherwise world would wait for it forever
+    while (true) {
         if (sem_post(&readySem) != 0) {
             syslog(LOG_WARNING, "sem_post() failed: %s", strerror(errno));
         }
-        actionCV.wait(uniqueLock);
-        uniqueLock.unlock();
-
         if (destroyed) {
             break;
         }
+        // Signals interrupt sem_wait even with SA_RESTART
+        while (sem_wait(&actionSem) == -1 && errno == EINTR) {
+        }
+
+        if (Trace::isEnabled()) {
+            Trace::Clock::time_point notified(Trace::Clock::duration(notifyTime.load()));
+            Trace::span("wakeup", "tank", notified, Trace::Clock::now());
+        }
 
-        doAction();
+        {
+            TraceSpan span("doAction", "tank");
+            doAction();
+        }
     }
 }
 
 int Tank::waitForTank()
+{
+    if (Trace::isEnabled()) {
+        if (sem_trywait(&readySem) == 0) {
+            return 0;
+        }
+        TraceSpan span("waitForTank", "world");
+        return waitForTankBlocking();
+    }
+    return waitForTankBlocking();
+}
+
+int Tank::waitForTankBlocking()
 {
     if (sem_wait(&readySem) == -1) {
         syslog(LOG_WARNING, "sem_wait() failed: %s", strerror(errno));
-        action = UNDEFINED;
         return -1;
     }
     return 0;
@@ -93,7 +106,9 @@ int Tank::waitForTank()
 
 void Tank::doAction()
 {
-    this->action = parseAction(currentAction);
+    if (actionTarget != nullptr) {
+        *actionTarget = parseAction(currentAction);
+    }
     if (sd_client != 0 && send(sd_client, currentAction, 2, 0) == -1) {
         syslog(LOG_ERR, "send() failed: %s", strerror(errno));
     }
@@ -153,11 +168,13 @@ void Tank::setNextAction(const char *actionStr)
     }
 }
 
-void Tank::_setActionToUndefined()
+void Tank::clearActions()
 {
-    this->action = UNDEFINED;
+    actionBuffer[0] = actionBuffer[2] = 'n';
+    actionBuffer[1] = actionBuffer[3] = 'o';
 }
 
+
 void Tank::setSocket(const sockaddr *addr, socklen_t addrlen)
 {
     if ((sd_client = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
@@ -169,3 +186,11 @@ void Tank::setSocket(const sockaddr *addr, socklen_t addrlen)
         throw std::runtime_error("connect() failed while assigning client to tank");
     }
 }
+
+void Tank::resetSocket()
+{
+    if (sd_client != 0) {
+        close(sd_client);
+        sd_client = 0;
+    }
+}
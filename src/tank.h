@@ -1,6 +1,9 @@
 #ifndef INTERNET_OF_TANKS_TANK_H
 #define INTERNET_OF_TANKS_TANK_H
 
+#include "action.h"
+#include "trace.h"
+
 #include <netdb.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -17,75 +20,63 @@
 #include <utility>
 #include <vector>
 
-enum Team
-{
-    GREEN, RED
-};
-
-enum Action
-{
-    UNDEFINED,
-    MOVE_UP, MOVE_DOWN, MOVE_RIGHT, MOVE_LEFT,
-    FIRE_UP, FIRE_DOWN, FIRE_RIGHT, FIRE_LEFT,
-    NO_ACTION
-};
-
-
 class Tank
 {
+    friend class Benchmark;
+
 public:
 
-    Tank(const Team &team);
+    Tank();
 
     virtual ~Tank()
     {
-        close(sd_client);
-        sem_destroy(&readySem);
+        // Thread may still send its last action, the socket is closed after it finished
         thread->join();
         delete thread;
+        resetSocket();
+        sem_destroy(&readySem);
+        sem_destroy(&actionSem);
     }
 
-    /**
-     * Check if the tank is marked as destroyed
-     */
-    bool isDestroyed() const;
-
     /**
      * Mark this tank as destroyed
      */
     Tank *markAsDestroyed();
 
-    /**
-     * Get action parsed by fetchAction method
-     */
-    const Action & getAction() const;
+    void setNextAction(const char* actionStr);
 
     /**
-     * Get team membership
+     * Forget actions sent by client which left the tank, so the next client does not perform them
      */
-    const Team & getTeam() const;
-
-    void _setActionToUndefined();
-
-    void setNextAction(const char* actionStr);
+    void clearActions();
 
     void setSocket(const struct sockaddr* addr, socklen_t addrlen);
 
     /**
-     * Contact all tanks and ask then about the action.
+     * Close socket to client which left the tank, actions are not sent anywhere until the next setSocket
+     */
+    void resetSocket();
+
+    /**
+     * Ask the tank about its action. Only notified tanks perform an action, so tanks
+     * without client cost nothing in rounds. Destroyed tank finishes its thread.
+     * @param action receives the parsed action before waitForTank returns, ignored if null
      */
-    static void notifyAllTanks();
+    void notify(uint8_t *action = nullptr);
 
+    /**
+     * Wait until tank thread performs its action. Blocked time is recorded when tracing.
+     * @return 0 on success, -1 if waiting failed
+     */
     int waitForTank();
 
 private:
 
-    static std::condition_variable actionCV;
-    static std::mutex actionMtx;
+    std::atomic<Trace::Clock::rep> notifyTime;    //<< when the tank was notified last time, for tracing
 
-    Team team;
     sem_t readySem;
-    Action action;
+    sem_t actionSem;    //<< posted by notify
+    uint8_t *actionTarget;  //<< where the next action is parsed into, set by notify
     char actionBuffer[4];
     char* currentAction;
 
@@ -95,6 +86,7 @@ private:
     std::atomic_bool destroyed;
 
     void threadFnc();
+    int waitForTankBlocking();
     void doAction();
     Action parseAction(const char* actionStr);
 };
@@ -3,12 +3,18 @@
 #include <locale.h>
 #include <ncurses.h>
 #include <netdb.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <syslog.h>
 #include <unistd.h>
+
+#include <chrono>
+#include <deque>
 #include <iostream>
+#include <string>
+#include <utility>
 
 #define _(STRING) gettext(STRING)
 using std::cout;
@@ -16,23 +22,34 @@ using std::endl;
 
 
 const char *IOT_PORT = "1337";
-const char *ARGS = "i:h";
+const char *ARGS = "i:a:h";
 const struct option LONG_ARGS[] = {
     {"ip-address", required_argument, NULL, 'i'},
+    {"arena", required_argument, NULL, 'a'},
     {"help", no_argument, NULL, 'h'},
     {0, 0, 0, 0}
 };
 
+typedef std::chrono::steady_clock Clock;
+
+const size_t MAX_PENDING_CMDS = 64;
+
 int sendCmdCurrentLine = 0;
 int recvCmdCurrentLine = 0;
 int sockfd;
 
+// Sent commands waiting for reply from world, oldest first
+std::deque<std::pair<std::string, Clock::time_point> > pendingCmds;
+
 void printHelp()
 {
     cout << _("Usage:") << endl;
     cout << "\t" << "-i, --ip-address <ipaddr>" << endl;
     cout << "\t\t" << _("ip address of the server (default is localhost)") << endl;
 
+    cout << "\t" << "-a, --arena <N>" << endl;
+    cout << "\t\t" << _("join arena <N> of world hosting several arenas") << endl;
+
     cout << "\t" << "-h, --help" << endl;
     cout << "\t\t" << _("shows this help") << endl << endl;
 
@@ -49,6 +66,10 @@ void sendMsg(const char *const msg)
     ssize_t rv = send(sockfd, msg, 2, MSG_DONTWAIT);
     if (rv == 2) {
         syslog(LOG_INFO, "send() sent msg: %s", msg);
+        if (pendingCmds.size() == MAX_PENDING_CMDS) {
+            pendingCmds.pop_front();
+        }
+        pendingCmds.push_back(std::make_pair(std::string(msg, 2), Clock::now()));
     }
     else if (rv == -1) {
         syslog(LOG_ERR, "send() failed: %s", strerror(errno));
@@ -69,64 +90,117 @@ void printSendCmd(const char *const msg)
     mvprintw(sendCmdCurrentLine++, 0, _("Sending command: %s"), msg);
 }
 
-void printRecvCmd(char *msg) {
+void printRecvCmd(const char *msg, double rtt) {
     attron(COLOR_PAIR(2));
     if (recvCmdCurrentLine == LINES) {
         clear();
         sendCmdCurrentLine = 0;
         recvCmdCurrentLine = 0;
     }
-    mvprintw(recvCmdCurrentLine++, COLS / 2, _("World received: %s"), msg);
+    if (rtt < 0) {
+        mvprintw(recvCmdCurrentLine++, COLS / 2, _("World received: %s"), msg);
+    } else {
+        mvprintw(recvCmdCurrentLine++, COLS / 2, _("World received: %s (%.1f ms)"), msg, rtt);
+    }
 }
 
-int readInput()
+/**
+ * Find the oldest command matching the reply and return its round trip time in milliseconds.
+ * Commands sent before the matching one will never be answered and are forgotten.
+ * @return -1 if no command matches
+ */
+double matchReply(const char *msg)
 {
-    int input = getch();
-    switch (input){
+    for (auto iter = pendingCmds.begin(); iter != pendingCmds.end(); ++iter) {
+        if (iter->first.compare(0, 2, msg, 2) == 0) {
+            double rtt = std::chrono::duration<double, std::milli>(Clock::now() - iter->second).count();
+            pendingCmds.erase(pendingCmds.begin(), iter + 1);
+            return rtt;
+        }
+    }
+    return -1;
+}
 
-        // Quit
-        case 'q':
-            return -1;
+/**
+ * Receive all datagrams waiting in socket
+ */
+void receiveMessages()
+{
+    char buff[3];
+    buff[2] = 0;
 
-        // Send move actions
-        case 'w':
-            sendMsg("mu");
-            printSendCmd(_("Move Up"));
-            break;
-        case 's':
-            sendMsg("md");
-            printSendCmd(_("Move Down"));
-            break;
-        case 'a':
-            sendMsg("ml");
-            printSendCmd(_("Move Left"));
-            break;
-        case 'd':
-            sendMsg("mr");
-            printSendCmd(_("Move Right"));
-            break;
+    while (true) {
+        ssize_t recvRet = recv(sockfd, buff, 2, MSG_DONTWAIT);
 
-        // Send fire actions
-        case KEY_LEFT:
-            sendMsg("fl");
-            printSendCmd(_("Fire Left"));
-            break;
-        case KEY_RIGHT:
-            sendMsg("fr");
-            printSendCmd(_("Fire Right"));
-            break;
-        case KEY_UP:
-            sendMsg("fu");
-            printSendCmd(_("Fire Up"));
-            break;
-        case KEY_DOWN:
-            sendMsg("fd");
-            printSendCmd(_("Fire Down"));
+        if (recvRet == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                syslog(LOG_ERR, "recv() failed: %s", strerror(errno));
+            }
             break;
+        }
+        else if (recvRet != 2) {
+            syslog(LOG_ERR, "recv() read %d chars instead of %d", (int) recvRet, 2);
+        }
+        else {
+            printRecvCmd(buff, matchReply(buff));
+        }
+    }
+}
 
-        // In case of none or unknown input do nothing
-        default:
-            break;
+/**
+ * Handle all keys pressed by user
+ * @return -1 if user wants to quit
+ */
+int readInput()
+{
+    int input;
+    while ((input = getch()) != ERR) {
+        switch (input){
+
+            // Quit
+            case 'q':
+                return -1;
+
+            // Send move actions
+            case 'w':
+                sendMsg("mu");
+                printSendCmd(_("Move Up"));
+                break;
+            case 's':
+                sendMsg("md");
+                printSendCmd(_("Move Down"));
+                break;
+            case 'a':
+                sendMsg("ml");
+                printSendCmd(_("Move Left"));
+                break;
+            case 'd':
+                sendMsg("mr");
+                printSendCmd(_("Move Right"));
+                break;
+
+            // Send fire actions
+            case KEY_LEFT:
+                sendMsg("fl");
+                printSendCmd(_("Fire Left"));
+                break;
+            case KEY_RIGHT:
+                sendMsg("fr");
+                printSendCmd(_("Fire Right"));
+                break;
+            case KEY_UP:
+                sendMsg("fu");
+                printSendCmd(_("Fire Up"));
+                break;
+            case KEY_DOWN:
+                sendMsg("fd");
+                printSendCmd(_("Fire Down"));
+                break;
+
+            // In case of none or unknown input do nothing
+            default:
+                break;
+        }
     }
 
     return 0;
@@ -140,12 +214,16 @@ int main(int argc, char *argv[])
 
     int opt = 0;
     std::string ip_address = "127.0.0.1";
+    std::string arena;
 
     while ((opt = getopt_long(argc, argv, ARGS, LONG_ARGS, NULL)) != -1) {
         switch (opt) {
         case 'i':
             ip_address = optarg;
             break;
+        case 'a':
+            arena = optarg;
+            break;
         case 'h':
             printHelp();
             return 0;
@@ -189,6 +267,15 @@ int main(int argc, char *argv[])
         syslog(LOG_ERR, "connect() failed: %s", strerror(errno));
     }
 
+    // Join arena before the first command
+
+    if (!arena.empty()) {
+        std::string join = "@" + arena;
+        if (send(sockfd, join.c_str(), join.size(), 0) == -1) {
+            syslog(LOG_ERR, "send() of arena failed: %s", strerror(errno));
+        }
+    }
+
     // Start ncurses
 
     initscr();
@@ -196,30 +283,39 @@ int main(int argc, char *argv[])
     noecho();
     keypad(stdscr, TRUE);
     curs_set(0);
-    timeout(500);
+    nodelay(stdscr, TRUE);
 
     start_color();
     init_pair(1, COLOR_WHITE, COLOR_BLACK);
     init_pair(2, COLOR_GREEN, COLOR_BLACK);
     init_pair(3, COLOR_RED, COLOR_BLACK);
 
-    // Listen for input and receive msg from socket
-
-    char buff[3];
-    buff[2] = 0;
-    while (readInput() == 0) {
-
-        ssize_t recvRet = recv(sockfd, buff, 2, MSG_DONTWAIT);
-
-        if (recvRet == -1) {
-            syslog(LOG_ERR, "recv() failed: %s", strerror(errno));
+    // Sleep until user presses a key or world replies
+
+    struct pollfd fds[2];
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = sockfd;
+    fds[1].events = POLLIN;
+
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno != EINTR) {
+                syslog(LOG_ERR, "poll() failed: %s", strerror(errno));
+                break;
+            }
+            // Terminal resize is reported by getch()
+            fds[0].revents = POLLIN;
+            fds[1].revents = 0;
         }
-        else if (recvRet != 2) {
-            syslog(LOG_ERR, "recv() read %d chars instead of %d", (int) recvRet, 2);
+
+        if (fds[1].revents) {
+            receiveMessages();
         }
-        else {
-            printRecvCmd(buff);
+        if (fds[0].revents && readInput() != 0) {
+            break;
         }
+        refresh();
     }
 
     // Clean up
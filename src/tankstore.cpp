@@ -0,0 +1,83 @@
+#include "tankstore.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using std::runtime_error;
+
+TankStore::TankStore(int areaX, int areaY)
+    : areaX(areaX), areaY(areaY), count(0), alive{0, 0}, round(0), grid((size_t) std::max(0, areaX) * std::max(0, areaY), -1)
+{
+}
+
+void TankStore::add(TankId id, Team team, int x, int y, Tank *thread)
+{
+    if (x < 0 || x >= areaX || y < 0 || y >= areaY) {
+        throw runtime_error("tank out of gameboard");
+    }
+    int32_t & field = grid[(size_t) y * areaX + x];
+    if (field != -1) {
+        throw runtime_error("position is occupied");
+    }
+
+    allocate(id, team, thread);
+    field = (int32_t) id;
+    this->x[id] = x;
+    this->y[id] = y;
+    status[id] = TANK_ALIVE;
+    alive[team]++;
+}
+
+void TankStore::addRemoved(TankId id, Team team, Tank *thread)
+{
+    allocate(id, team, thread);
+}
+
+void TankStore::allocate(TankId id, Team team, Tank *thread)
+{
+    // Tank may have no thread until a client takes it
+    if (id < count && (this->thread[id] != nullptr || status[id] != TANK_GONE || bound[id])) {
+        throw runtime_error("tank id is used");
+    }
+
+    // Slots survive clear, so arrays grow only when a game has more tanks than all previous ones
+    if (id >= this->thread.size()) {
+        size_t size = (size_t) id + 1;
+        this->team.resize(size);
+        action.resize(size);
+        status.resize(size);
+        x.resize(size);
+        y.resize(size);
+        bound.resize(size);
+        client.resize(size);
+        this->thread.resize(size);
+    }
+    count = std::max(count, id + 1);
+
+    this->team[id] = (uint8_t) team;
+    action[id] = UNDEFINED;
+    status[id] = TANK_GONE;
+    bound[id] = 0;
+    this->thread[id] = thread;
+}
+
+void TankStore::clear()
+{
+    for (TankId id = 0; id < count; id++) {
+        if (status[id] != TANK_GONE) {
+            grid[(size_t) y[id] * areaX + x[id]] = -1;
+        }
+        status[id] = TANK_GONE;
+        bound[id] = 0;
+        thread[id] = nullptr;
+    }
+    count = 0;
+    alive[GREEN] = 0;
+    alive[RED] = 0;
+}
+
+EngineState TankStore::state()
+{
+    return EngineState{areaX, areaY, count, grid.data(), x.data(), y.data(), team.data(), status.data(),
+                       alive, &round};
+}
@@ -0,0 +1,117 @@
+#ifndef INTERNET_OF_TANKS_TANKSTORE_H
+#define INTERNET_OF_TANKS_TANKSTORE_H
+
+#include "action.h"
+#include "engine.h"
+
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class Tank;
+
+typedef uint32_t TankId;
+
+/**
+ * State of all tanks of a world in parallel arrays indexed by tank id, together with the gameboard
+ * holding ids of tanks on every field. Ids are indexes of slots, slots are reused by the next game.
+ */
+class TankStore
+{
+public:
+
+    TankStore(int areaX, int areaY);
+
+    /**
+     * Put new tank on given field, slots up to id are allocated as removed tanks
+     * @throw runtime_error if the field is outside of gameboard or occupied or the id is used
+     */
+    void add(TankId id, Team team, int x, int y, Tank *thread);
+
+    /**
+     * Add tank which is already removed from gameboard, it holds binding of its client
+     * @throw runtime_error if the id is used
+     */
+    void addRemoved(TankId id, Team team, Tank *thread);
+
+    /**
+     * Remove all tanks, their slots are reused by the next game. Threads of tanks are not deleted.
+     */
+    void clear();
+
+    /**
+     * Number of slots used by the current game, ids of its tanks are lower
+     */
+    TankId size() const
+    {
+        return count;
+    }
+
+    /**
+     * Get id of tank on field or -1 if it is empty
+     */
+    int32_t at(int x, int y) const
+    {
+        return grid[(size_t) y * areaX + x];
+    }
+
+    bool isRowFull(int y) const
+    {
+        const int32_t *row = &grid[(size_t) y * areaX];
+        return std::find(row, row + areaX, -1) == row + areaX;
+    }
+
+    bool isOnBoard(TankId id) const
+    {
+        return status[id] != TANK_GONE;
+    }
+
+    /**
+     * Remember address of client controlling the tank
+     */
+    void bind(TankId id, const struct sockaddr_in & addr)
+    {
+        bound[id] = 1;
+        client[id] = addr;
+    }
+
+    /**
+     * Forget client of the tank, the tank can be given to another client
+     */
+    void unbind(TankId id)
+    {
+        bound[id] = 0;
+    }
+
+    /**
+     * View for simulation of rounds by engine
+     */
+    EngineState state();
+
+    std::vector<uint8_t> team;
+    std::vector<uint8_t> action;            //<< action performed in the current round
+    std::vector<uint8_t> status;            //<< EngineStatus
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+    std::vector<uint8_t> bound;             //<< tank is controlled by client
+    std::vector<struct sockaddr_in> client;
+    std::vector<Tank *> thread;             //<< thread parsing actions of the tank, null until a client takes a restored tank
+
+private:
+    int areaX;
+    int areaY;
+    TankId count;
+    uint32_t alive[2];
+    uint32_t round;                         //<< required by EngineState, rounds are counted by world
+    std::vector<int32_t> grid;
+
+    /**
+     * Allocate slots up to id
+     * @throw runtime_error if the id is used
+     */
+    void allocate(TankId id, Team team, Tank *thread);
+};
+
+#endif //INTERNET_OF_TANKS_TANKSTORE_H
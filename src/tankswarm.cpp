@@ -0,0 +1,421 @@
+#include "stats.h"
+
+#include <getopt.h>
+#include <libintl.h>
+#include <locale.h>
+#include <netdb.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define _(STRING) gettext(STRING)
+using std::cout;
+using std::endl;
+
+
+const char *ARGS = "i:p:c:a:r:d:m:s:t:h";
+const struct option LONG_ARGS[] = {
+    {"ip-address", required_argument, NULL, 'i'},
+    {"port", required_argument, NULL, 'p'},
+    {"clients", required_argument, NULL, 'c'},
+    {"arenas", required_argument, NULL, 'a'},
+    {"rate", required_argument, NULL, 'r'},
+    {"duration", required_argument, NULL, 'd'},
+    {"action-mix", required_argument, NULL, 'm'},
+    {"seed", required_argument, NULL, 's'},
+    {"timeout", required_argument, NULL, 't'},
+    {"help", no_argument, NULL, 'h'},
+    {0, 0, 0, 0}
+};
+
+typedef std::chrono::steady_clock Clock;
+
+const size_t MAX_PENDING_CMDS = 64;
+const int RECV_BATCH = 16;
+
+/**
+ * One simulated tankclient with its own source port
+ */
+struct VirtualClient
+{
+    int sockfd;
+    std::deque<std::pair<uint16_t, Clock::time_point> > pendingCmds;   //<< sent commands waiting for reply, oldest first
+    bool answered;      //<< world assigned a tank to this client
+};
+
+struct SwarmStats
+{
+    uint64_t sent = 0;
+    uint64_t sendErrors = 0;
+    uint64_t received = 0;
+    uint64_t lost = 0;          //<< commands without reply in timeout or skipped by a later reply
+    uint64_t unexpected = 0;    //<< replies which match no sent command
+    Histogram latency;          //<< echo latency in nanoseconds
+};
+
+volatile bool done = false;
+
+static void sigHandler(int)
+{
+    done = true;
+}
+
+void printHelp()
+{
+    cout << _("Usage:") << endl;
+    cout << "\t" << "-i, --ip-address <ipaddr>" << endl;
+    cout << "\t\t" << _("ip address of the server (default is localhost)") << endl;
+
+    cout << "\t" << "-p, --port <N>" << endl;
+    cout << "\t\t" << _("port of the server (default 1337)") << endl;
+
+    cout << "\t" << "-c, --clients <N>" << endl;
+    cout << "\t\t" << _("number of simulated clients, each has its own socket (default 1000)") << endl;
+
+    cout << "\t" << "-a, --arenas <N>" << endl;
+    cout << "\t\t" << _("clients join arenas 0 to <N>-1 of world hosting several arenas in turn (default no joining)") << endl;
+
+    cout << "\t" << "-r, --rate <N>" << endl;
+    cout << "\t\t" << _("commands per second sent by each client (default 10)") << endl;
+
+    cout << "\t" << "-d, --duration <N>" << endl;
+    cout << "\t\t" << _("run for <N> seconds (default 10)") << endl;
+
+    cout << "\t" << "-m, --action-mix <M:F:I>" << endl;
+    cout << "\t\t" << _("ratio of move, fire and idle commands (default 50:1:49)") << endl;
+
+    cout << "\t" << "-s, --seed <N>" << endl;
+    cout << "\t\t" << _("seed of random commands (default 1)") << endl;
+
+    cout << "\t" << "-t, --timeout <N>" << endl;
+    cout << "\t\t" << _("command without reply in <N> milliseconds is lost (default 2000)") << endl;
+
+    cout << "\t" << "-h, --help" << endl;
+    cout << "\t\t" << _("shows this help") << endl << endl;
+}
+
+/**
+ * Raise limit of open files to the hard limit, so that tens of thousands of sockets can be opened
+ */
+void raiseFileLimit(size_t needed)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < needed) {
+        limit.rlim_cur = limit.rlim_max == RLIM_INFINITY ? needed : std::min((rlim_t) needed, limit.rlim_max);
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            syslog(LOG_WARNING, "setrlimit() failed: %s", strerror(errno));
+        }
+    }
+}
+
+uint16_t commandCode(const char *cmd)
+{
+    return (uint16_t) ((uint8_t) cmd[0] << 8 | (uint8_t) cmd[1]);
+}
+
+/**
+ * Match reply to the oldest pending command with the same content. Older commands were not
+ * answered, world answers commands in order, so they are lost. Commands sent before deadline
+ * are lost even if their reply comes now.
+ */
+void matchReply(VirtualClient & client, uint16_t reply, Clock::time_point now, Clock::time_point deadline,
+                SwarmStats & stats)
+{
+    while (!client.pendingCmds.empty() && client.pendingCmds.front().second < deadline) {
+        client.pendingCmds.pop_front();
+        stats.lost++;
+    }
+    for (size_t i = 0; i < client.pendingCmds.size(); i++) {
+        if (client.pendingCmds[i].first == reply) {
+            stats.lost += i;
+            stats.latency.record((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - client.pendingCmds[i].second).count());
+            client.pendingCmds.erase(client.pendingCmds.begin(), client.pendingCmds.begin() + i + 1);
+            stats.received++;
+            client.answered = true;
+            return;
+        }
+    }
+    stats.unexpected++;
+}
+
+void expirePending(std::vector<VirtualClient> & clients, Clock::time_point deadline, SwarmStats & stats)
+{
+    for (VirtualClient & client : clients) {
+        while (!client.pendingCmds.empty() && client.pendingCmds.front().second < deadline) {
+            client.pendingCmds.pop_front();
+            stats.lost++;
+        }
+    }
+}
+
+void printProgress(double seconds, const SwarmStats & stats, size_t answered)
+{
+    printf("%6.1f s  sent %10lu  received %10lu  lost %8lu  answered clients %7zu  "
+           "latency p50 %8.3f ms  p99 %8.3f ms\n",
+           seconds, (unsigned long) stats.sent, (unsigned long) stats.received, (unsigned long) stats.lost, answered,
+           stats.latency.valueAtQuantile(0.5) / 1e6, stats.latency.valueAtQuantile(0.99) / 1e6);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    setlocale(LC_ALL, "");
+    bindtextdomain("tankswarm", "../locale");
+    textdomain("tankswarm");
+
+    int opt = 0;
+    std::string ip_address = "127.0.0.1";
+    std::string port = "1337";
+    size_t clientCount = 1000;
+    unsigned int arenaCount = 0;
+    double rate = 10;
+    double duration = 10;
+    unsigned int moveRatio = 50;
+    unsigned int fireRatio = 1;
+    unsigned int idleRatio = 49;
+    unsigned int seed = 1;
+    long timeoutMs = 2000;
+
+    while ((opt = getopt_long(argc, argv, ARGS, LONG_ARGS, NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            ip_address = optarg;
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        case 'c':
+            clientCount = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            arenaCount = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%u:%u:%u", &moveRatio, &fireRatio, &idleRatio) != 3
+                || moveRatio + fireRatio + idleRatio == 0) {
+                cout << _("invalid action mix") << endl;
+                exit(1);
+            }
+            break;
+        case 's':
+            seed = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            timeoutMs = atol(optarg);
+            break;
+        case 'h':
+            printHelp();
+            return 0;
+        default:
+            printHelp();
+            exit(1);
+        }
+    }
+    if (clientCount == 0 || rate <= 0 || duration <= 0 || timeoutMs <= 0) {
+        cout << _("invalid options provided") << endl;
+        exit(1);
+    }
+
+    // Prepare server info
+
+    struct addrinfo hints;
+    struct addrinfo *servinfo;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    int rv;
+    if ((rv = getaddrinfo(ip_address.c_str(), port.c_str(), &hints, &servinfo)) != 0) {
+        cout << "getaddrinfo() failed: " << gai_strerror(rv) << endl;
+        exit(1);
+    }
+
+    // Create one connected socket for every client, each gets its own source port
+
+    raiseFileLimit(clientCount + 64);
+    int epfd = epoll_create1(0);
+    if (epfd == -1) {
+        cout << "epoll_create1() failed: " << strerror(errno) << endl;
+        exit(1);
+    }
+
+    std::vector<VirtualClient> clients(clientCount);
+    for (size_t i = 0; i < clientCount; i++) {
+        clients[i].answered = false;
+        clients[i].sockfd = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
+        if (clients[i].sockfd == -1 || connect(clients[i].sockfd, servinfo->ai_addr, servinfo->ai_addrlen) == -1) {
+            cout << _("creating client") << " " << i << " " << _("failed") << ": " << strerror(errno) << endl;
+            exit(1);
+        }
+        if (arenaCount > 0) {
+            std::string join = "@" + std::to_string(i % arenaCount);
+            if (send(clients[i].sockfd, join.c_str(), join.size(), 0) == -1) {
+                cout << _("joining arena failed") << ": " << strerror(errno) << endl;
+                exit(1);
+            }
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].sockfd, &event) == -1) {
+            cout << "epoll_ctl() failed: " << strerror(errno) << endl;
+            exit(1);
+        }
+    }
+    freeaddrinfo(servinfo);
+
+    struct sigaction sigAction;
+    sigemptyset(&sigAction.sa_mask);
+    sigAction.sa_flags = 0;
+    sigAction.sa_handler = sigHandler;
+    sigaction(SIGINT, &sigAction, NULL);
+    sigaction(SIGTERM, &sigAction, NULL);
+
+    // Send commands evenly over time, round robin over clients, and collect replies
+
+    const char *moves[] = {"mu", "md", "ml", "mr"};
+    const char *fires[] = {"fu", "fd", "fl", "fr"};
+    std::mt19937 random(seed);
+    unsigned int mixTotal = moveRatio + fireRatio + idleRatio;
+
+    SwarmStats stats;
+    std::vector<struct epoll_event> events(1024);
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iovecs[RECV_BATCH];
+    char buffers[RECV_BATCH][2];
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = sizeof buffers[i];
+        memset(&msgs[i].msg_hdr, 0, sizeof msgs[i].msg_hdr);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::microseconds((long) (duration * 1e6));
+    Clock::time_point nextProgress = start + std::chrono::seconds(1);
+    std::chrono::milliseconds timeout(timeoutMs);
+    size_t nextClient = 0;
+    uint64_t scheduled = 0;
+
+    while (!done) {
+        Clock::time_point now = Clock::now();
+        if (now >= end) {
+            break;
+        }
+
+        uint64_t due = (uint64_t) (std::chrono::duration<double>(now - start).count() * rate * clientCount);
+        for (; scheduled < due; scheduled++) {
+            VirtualClient & client = clients[nextClient];
+            nextClient = (nextClient + 1) % clientCount;
+
+            unsigned int draw = random() % mixTotal;
+            const char *cmd = draw < moveRatio ? moves[random() % 4]
+                            : draw < moveRatio + fireRatio ? fires[random() % 4] : "no";
+            if (send(client.sockfd, cmd, 2, MSG_DONTWAIT) != 2) {
+                stats.sendErrors++;
+                continue;
+            }
+            stats.sent++;
+            if (client.pendingCmds.size() == MAX_PENDING_CMDS) {
+                client.pendingCmds.pop_front();
+                stats.lost++;
+            }
+            client.pendingCmds.push_back(std::make_pair(commandCode(cmd), now));
+        }
+
+        // Wait at most until the next command is due
+        int waitMs = (int) std::min<double>(1000.0 / (rate * clientCount) + 1, 100);
+        int ready = epoll_wait(epfd, events.data(), (int) events.size(), waitMs);
+        if (ready == -1 && errno != EINTR) {
+            cout << "epoll_wait() failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        now = Clock::now();
+        for (int i = 0; i < ready; i++) {
+            VirtualClient & client = clients[events[i].data.u64];
+            int count;
+            while ((count = recvmmsg(client.sockfd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL)) > 0) {
+                for (int j = 0; j < count; j++) {
+                    if (msgs[j].msg_len == 2) {
+                        matchReply(client, commandCode(buffers[j]), now, now - timeout, stats);
+                    }
+                }
+            }
+        }
+
+        if (now >= nextProgress) {
+            expirePending(clients, now - timeout, stats);
+            size_t answered = 0;
+            for (const VirtualClient & client : clients) {
+                answered += client.answered;
+            }
+            printProgress(std::chrono::duration<double>(now - start).count(), stats, answered);
+            nextProgress += std::chrono::seconds(1);
+        }
+    }
+
+    // Wait for replies of the last commands, then everything pending is lost
+
+    Clock::time_point drainEnd = Clock::now() + timeout;
+    while (!done && Clock::now() < drainEnd) {
+        int ready = epoll_wait(epfd, events.data(), (int) events.size(), 10);
+        Clock::time_point now = Clock::now();
+        for (int i = 0; i < ready; i++) {
+            VirtualClient & client = clients[events[i].data.u64];
+            int count;
+            while ((count = recvmmsg(client.sockfd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL)) > 0) {
+                for (int j = 0; j < count; j++) {
+                    if (msgs[j].msg_len == 2) {
+                        matchReply(client, commandCode(buffers[j]), now, now - timeout, stats);
+                    }
+                }
+            }
+        }
+    }
+    expirePending(clients, Clock::time_point::max(), stats);
+
+    size_t answered = 0;
+    for (VirtualClient & client : clients) {
+        answered += client.answered;
+        close(client.sockfd);
+    }
+    close(epfd);
+
+    double seconds = std::chrono::duration<double>(std::min(Clock::now(), end) - start).count();
+    printf("\nclients %zu, answered %zu (%.1f %%)\n", clientCount, answered, 100.0 * answered / clientCount);
+    printf("sent %lu (%.0f/s), send errors %lu\n", (unsigned long) stats.sent, stats.sent / seconds,
+           (unsigned long) stats.sendErrors);
+    printf("received %lu, lost %lu (%.2f %%), unexpected %lu\n", (unsigned long) stats.received,
+           (unsigned long) stats.lost, stats.sent ? 100.0 * stats.lost / stats.sent : 0.0,
+           (unsigned long) stats.unexpected);
+    printf("echo latency ms: p50 %.3f, p99 %.3f, p999 %.3f, mean %.3f\n",
+           stats.latency.valueAtQuantile(0.5) / 1e6, stats.latency.valueAtQuantile(0.99) / 1e6,
+           stats.latency.valueAtQuantile(0.999) / 1e6,
+           stats.latency.count() ? stats.latency.getSum() / 1e6 / stats.latency.count() : 0.0);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threads)
+    : stopping(false), generation(0), running(0), task(nullptr), count(0), chunk(1), next(0)
+{
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned int i = 1; i < threads; i++) {
+        workers.push_back(std::thread(&ThreadPool::workerFnc, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> uniqueLock(mtx);
+        stopping = true;
+    }
+    startCV.notify_all();
+    for (std::thread & worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, size_t chunk, const Task & task)
+{
+    if (count == 0) {
+        return;
+    }
+    chunk = std::max((size_t) 1, chunk);
+
+    // Small loops are not worth waking the workers
+    if (workers.empty() || count <= chunk) {
+        task(0, count, 0);
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> uniqueLock(mtx);
+        this->task = &task;
+        this->count = count;
+        this->chunk = chunk;
+        next = 0;
+        running = (unsigned int) workers.size();
+        generation++;
+    }
+    startCV.notify_all();
+
+    runChunks(0);
+
+    std::unique_lock<std::mutex> uniqueLock(mtx);
+    doneCV.wait(uniqueLock, [this] { return running == 0; });
+    this->task = nullptr;
+}
+
+void ThreadPool::workerFnc(unsigned int worker)
+{
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> uniqueLock(mtx);
+            startCV.wait(uniqueLock, [this, seen] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        runChunks(worker);
+
+        std::unique_lock<std::mutex> uniqueLock(mtx);
+        if (--running == 0) {
+            doneCV.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runChunks(unsigned int worker)
+{
+    size_t begin;
+    while ((begin = next.fetch_add(chunk)) < count) {
+        (*task)(begin, std::min(count, begin + chunk), worker);
+    }
+}
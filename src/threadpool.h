@@ -0,0 +1,63 @@
+#ifndef INTERNET_OF_TANKS_THREADPOOL_H
+#define INTERNET_OF_TANKS_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads running one parallel loop at a time. The calling thread
+ * takes part in the loop too, so a pool of one thread runs everything in the caller.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * Function processing items [begin, end) on worker with given index
+     */
+    typedef std::function<void(size_t begin, size_t end, unsigned int worker)> Task;
+
+    /**
+     * @param threads number of threads including the caller, 0 means number of CPUs
+     * @throw system_error if a thread cannot be created
+     */
+    ThreadPool(unsigned int threads = 0);
+
+    ~ThreadPool();
+
+    unsigned int size() const
+    {
+        return (unsigned int) workers.size() + 1;
+    }
+
+    /**
+     * Split count items into chunks of given size and process them on all threads.
+     * Returns after all chunks are processed.
+     */
+    void parallelFor(size_t count, size_t chunk, const Task & task);
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex mtx;
+    std::condition_variable startCV;
+    std::condition_variable doneCV;
+    bool stopping;
+    unsigned long generation;       //<< increased by every parallelFor
+    unsigned int running;           //<< workers which did not finish the current loop
+
+    const Task *task;
+    size_t count;
+    size_t chunk;
+    std::atomic<size_t> next;       //<< first item of the next chunk
+
+    void workerFnc(unsigned int worker);
+
+    void runChunks(unsigned int worker);
+};
+
+#endif //INTERNET_OF_TANKS_THREADPOOL_H
@@ -0,0 +1,120 @@
+#include "timerwheel.h"
+
+#include <algorithm>
+
+const int TimerWheel::SLOT_BITS;
+const int TimerWheel::SLOTS;
+const int TimerWheel::LEVELS;
+
+TimerWheel::TimerWheel()
+    : current(0), heads((size_t) LEVELS * SLOTS, -1)
+{
+}
+
+void TimerWheel::schedule(uint32_t id, uint64_t when)
+{
+    if (id >= slot.size()) {
+        next.resize((size_t) id + 1, -1);
+        prev.resize((size_t) id + 1, -1);
+        slot.resize((size_t) id + 1, -1);
+        expires.resize((size_t) id + 1, 0);
+    }
+    if (slot[id] != -1) {
+        unlink(id);
+    }
+    expires[id] = std::max(when, current + 1);
+    insert(id);
+}
+
+void TimerWheel::cancel(uint32_t id)
+{
+    if (isScheduled(id)) {
+        unlink(id);
+    }
+}
+
+void TimerWheel::advance(uint64_t tick, std::vector<uint32_t> & expired)
+{
+    while (current < tick) {
+        current++;
+
+        // Slot of a higher level is cascaded when all slots of the level below it were passed
+        int index = (int) (current & (SLOTS - 1));
+        for (int level = 1; level < LEVELS && index == 0; level++) {
+            index = (int) ((current >> (level * SLOT_BITS)) & (SLOTS - 1));
+            cascade(level, index);
+        }
+
+        int32_t id = heads[current & (SLOTS - 1)];
+        while (id != -1) {
+            int32_t following = next[id];
+            unlink((uint32_t) id);
+            if (expires[id] <= current) {
+                expired.push_back((uint32_t) id);
+            } else {
+                insert((uint32_t) id);
+            }
+            id = following;
+        }
+    }
+}
+
+void TimerWheel::clear()
+{
+    current = 0;
+    std::fill(heads.begin(), heads.end(), -1);
+    next.clear();
+    prev.clear();
+    slot.clear();
+    expires.clear();
+}
+
+void TimerWheel::insert(uint32_t id)
+{
+    uint64_t delta = expires[id] - current;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (uint64_t) 1 << ((level + 1) * SLOT_BITS)) {
+        level++;
+    }
+
+    // Timers beyond the last level wait in its farthest slot and are placed again by its cascade
+    uint64_t when = expires[id];
+    if (delta >= (uint64_t) 1 << (LEVELS * SLOT_BITS)) {
+        when = current + ((uint64_t) 1 << (LEVELS * SLOT_BITS)) - 1;
+    }
+
+    int index = level * SLOTS + (int) ((when >> (level * SLOT_BITS)) & (SLOTS - 1));
+    slot[id] = index;
+    prev[id] = -1;
+    next[id] = heads[index];
+    if (heads[index] != -1) {
+        prev[heads[index]] = (int32_t) id;
+    }
+    heads[index] = (int32_t) id;
+}
+
+void TimerWheel::unlink(uint32_t id)
+{
+    if (prev[id] != -1) {
+        next[prev[id]] = next[id];
+    } else {
+        heads[slot[id]] = next[id];
+    }
+    if (next[id] != -1) {
+        prev[next[id]] = prev[id];
+    }
+    slot[id] = -1;
+    next[id] = -1;
+    prev[id] = -1;
+}
+
+void TimerWheel::cascade(int level, int index)
+{
+    int32_t id = heads[level * SLOTS + index];
+    heads[level * SLOTS + index] = -1;
+    while (id != -1) {
+        int32_t following = next[id];
+        insert((uint32_t) id);
+        id = following;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef INTERNET_OF_TANKS_TIMERWHEEL_H
+#define INTERNET_OF_TANKS_TIMERWHEEL_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Hierarchical timer wheel of timers identified by small integer ids. Time is counted in ticks.
+ * Level 0 has a slot for every one of the next 64 ticks, every higher level has slots 64 times
+ * longer and its slot is cascaded into the lower levels when the wheel reaches it. Scheduling and
+ * cancelling a timer is O(1), every timer is moved by cascades at most LEVELS - 1 times.
+ * Timers are kept in intrusive lists in arrays indexed by id, so the wheel allocates only
+ * when a new highest id is scheduled.
+ */
+class TimerWheel
+{
+public:
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int LEVELS = 4;
+
+    TimerWheel();
+
+    /**
+     * Schedule timer of id at tick when, timer of id which is already scheduled is moved.
+     * Timer in the past expires at the next tick.
+     */
+    void schedule(uint32_t id, uint64_t when);
+
+    /**
+     * Stop timer of id if it is scheduled
+     */
+    void cancel(uint32_t id);
+
+    bool isScheduled(uint32_t id) const
+    {
+        return id < slot.size() && slot[id] != -1;
+    }
+
+    uint64_t now() const
+    {
+        return current;
+    }
+
+    /**
+     * Move the wheel to tick, ids of expired timers are appended to expired in the order of their ticks
+     */
+    void advance(uint64_t tick, std::vector<uint32_t> & expired);
+
+    /**
+     * Cancel all timers and start again from tick 0
+     */
+    void clear();
+
+private:
+    uint64_t current;                   //<< the last tick reached by advance
+    std::vector<int32_t> heads;         //<< first timer of every slot of every level, -1 is empty
+    std::vector<int32_t> next;          //<< indexed by id
+    std::vector<int32_t> prev;
+    std::vector<int32_t> slot;          //<< index into heads, -1 if not scheduled
+    std::vector<uint64_t> expires;
+
+    void insert(uint32_t id);
+
+    void unlink(uint32_t id);
+
+    /**
+     * Reinsert timers of slot of level into lower levels
+     */
+    void cascade(int level, int index);
+};
+
+#endif //INTERNET_OF_TANKS_TIMERWHEEL_H
@@ -0,0 +1,138 @@
+#include "trace.h"
+
+#include <sys/syscall.h>
+#include <sys/syslog.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+std::atomic_bool Trace::enabled(false);
+std::string Trace::path;
+thread_local Trace::BufferOwner Trace::owner;
+thread_local std::string Trace::threadName;
+
+std::mutex Trace::buffersMtx;
+std::vector<Trace::Buffer*> Trace::buffers;
+
+void Trace::setOutput(const std::string & path)
+{
+    Trace::path = path;
+}
+
+void Trace::start()
+{
+    if (path.empty() || isEnabled()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> uniqueLock(buffersMtx);
+    for (Buffer *buffer : buffers) {
+        std::unique_lock<std::mutex> bufferLock(buffer->mtx);
+        buffer->events.clear();
+        buffer->dropped = 0;
+    }
+    enabled = true;
+    syslog(LOG_INFO, "tracing started");
+}
+
+int Trace::stop()
+{
+    if (!isEnabled()) {
+        return 0;
+    }
+    enabled = false;
+
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        syslog(LOG_ERR, "fopen() of trace file %s failed: %s", path.c_str(), strerror(errno));
+    }
+
+    int pid = getpid();
+    unsigned long dropped = 0;
+    bool first = true;
+    if (file != nullptr) {
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    }
+
+    std::unique_lock<std::mutex> uniqueLock(buffersMtx);
+    auto iter = buffers.begin();
+    while (iter != buffers.end()) {
+        Buffer *buffer = *iter;
+        bool orphaned = buffer->orphaned;
+        std::vector<Event> events;
+        {
+            std::unique_lock<std::mutex> bufferLock(buffer->mtx);
+            events.swap(buffer->events);
+            dropped += buffer->dropped;
+            buffer->dropped = 0;
+        }
+
+        if (file != nullptr && !events.empty()) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", pid, buffer->tid, buffer->name.c_str());
+            first = false;
+            for (const Event & event : events) {
+                fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                        event.name, event.category,
+                        std::chrono::duration<double, std::micro>(event.start.time_since_epoch()).count(),
+                        std::chrono::duration<double, std::micro>(event.end - event.start).count(),
+                        pid, buffer->tid);
+            }
+        }
+
+        if (orphaned) {
+            delete buffer;
+            iter = buffers.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+
+    if (file == nullptr) {
+        return -1;
+    }
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        syslog(LOG_ERR, "writing trace file %s failed: %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+    if (dropped > 0) {
+        syslog(LOG_WARNING, "%lu trace events dropped", dropped);
+    }
+    syslog(LOG_INFO, "tracing stopped, trace written into %s", path.c_str());
+    return 0;
+}
+
+void Trace::setThreadName(const std::string & name)
+{
+    threadName = name;
+    if (owner.buffer != nullptr) {
+        std::unique_lock<std::mutex> bufferLock(owner.buffer->mtx);
+        owner.buffer->name = name;
+    }
+}
+
+Trace::Buffer *Trace::threadBuffer()
+{
+    if (owner.buffer == nullptr) {
+        owner.buffer = new Buffer;
+        owner.buffer->tid = (int) syscall(SYS_gettid);
+        owner.buffer->name = threadName.empty() ? "thread" : threadName;
+        std::unique_lock<std::mutex> uniqueLock(buffersMtx);
+        buffers.push_back(owner.buffer);
+    }
+    return owner.buffer;
+}
+
+void Trace::append(const char *name, const char *category, Clock::time_point start, Clock::time_point end)
+{
+    Buffer *buffer = threadBuffer();
+    std::unique_lock<std::mutex> bufferLock(buffer->mtx);
+    if (buffer->events.size() >= Buffer::MAX_EVENTS) {
+        buffer->dropped++;
+        return;
+    }
+    buffer->events.push_back(Event{name, category, start, end});
+}
@@ -0,0 +1,138 @@
+#ifndef INTERNET_OF_TANKS_TRACE_H
+#define INTERNET_OF_TANKS_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Recorder of spans in Chrome trace event format, which can be opened in chrome://tracing or Perfetto.
+ * Every thread records into its own buffer, buffers are collected and written into file when tracing stops.
+ */
+class Trace
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Set file where events are written when tracing stops. Tracing is possible only when it is set.
+     */
+    static void setOutput(const std::string & path);
+
+    /**
+     * Start recording, events recorded before are discarded
+     */
+    static void start();
+
+    /**
+     * Stop recording and write recorded events into output file
+     * @return 0 on success, -1 if the file cannot be written
+     */
+    static int stop();
+
+    static bool isEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Name of calling thread shown in trace viewer. Does not allocate the buffer of the thread.
+     */
+    static void setThreadName(const std::string & name);
+
+    /**
+     * Record span of calling thread
+     * @param name static string with name of the span
+     * @param category static string with category of the span
+     */
+    static void span(const char *name, const char *category, Clock::time_point start, Clock::time_point end)
+    {
+        if (isEnabled()) {
+            append(name, category, start, end);
+        }
+    }
+
+private:
+
+    struct Event
+    {
+        const char *name;
+        const char *category;
+        Clock::time_point start;
+        Clock::time_point end;
+    };
+
+    struct Buffer
+    {
+        static const size_t MAX_EVENTS = 1 << 20;
+
+        std::mutex mtx;         //<< locked by collecting thread only when tracing stops
+        std::vector<Event> events;
+        std::string name;
+        int tid;
+        unsigned long dropped;
+        std::atomic_bool orphaned;
+
+        Buffer() : tid(0), dropped(0), orphaned(false) { }
+    };
+
+    /**
+     * Marks buffer of the thread as orphaned when the thread ends
+     */
+    struct BufferOwner
+    {
+        Buffer *buffer = nullptr;
+
+        ~BufferOwner()
+        {
+            if (buffer != nullptr) {
+                buffer->orphaned = true;
+            }
+        }
+    };
+
+    static std::atomic_bool enabled;
+    static std::string path;
+    static thread_local BufferOwner owner;
+    static thread_local std::string threadName;
+
+    static std::mutex buffersMtx;
+    static std::vector<Buffer*> buffers;
+
+    static Buffer *threadBuffer();
+
+    static void append(const char *name, const char *category, Clock::time_point start, Clock::time_point end);
+};
+
+/**
+ * Record span from construction to destruction
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const char *name, const char *category)
+        : name(name), category(category), enabled(Trace::isEnabled())
+    {
+        if (enabled) {
+            start = Trace::Clock::now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (enabled) {
+            Trace::span(name, category, start, Trace::Clock::now());
+        }
+    }
+
+private:
+    const char *name;
+    const char *category;
+    bool enabled;
+    Trace::Clock::time_point start;
+};
+
+#endif //INTERNET_OF_TANKS_TRACE_H
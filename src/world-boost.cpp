@@ -1,4 +1,8 @@
 #include "world.h"
+#include "arena.h"
+#include "engine.h"
+#include "eventlog.h"
+#include "trace.h"
 
 #include <fcntl.h>
 #include <getopt.h>
@@ -7,8 +11,14 @@
 #include <sys/stat.h>
 #include <sys/file.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <sys/inotify.h>
 
 #define _(STRING) gettext(STRING)
@@ -26,6 +36,31 @@ const struct option LONG_ARGS[] = {
     {"daemonize", no_argument, NULL, 'd'},
     {"pipe", required_argument, NULL, 'p'},
     {"round-time", required_argument, NULL, 0},
+    {"log-file", required_argument, NULL, 0},
+    {"log-level", required_argument, NULL, 0},
+    {"stats", required_argument, NULL, 0},
+    {"trace-file", required_argument, NULL, 0},
+    {"seed", required_argument, NULL, 0},
+    {"journal", required_argument, NULL, 0},
+    {"replay", required_argument, NULL, 0},
+    {"archive", required_argument, NULL, 0},
+    {"keyframe-interval", required_argument, NULL, 0},
+    {"benchmark", no_argument, NULL, 0},
+    {"rounds", required_argument, NULL, 0},
+    {"action-mix", required_argument, NULL, 0},
+    {"replay-engine", required_argument, NULL, 0},
+    {"snapshot", required_argument, NULL, 0},
+    {"snapshot-interval", required_argument, NULL, 0},
+    {"restore", required_argument, NULL, 0},
+    {"ingest-packets", required_argument, NULL, 0},
+    {"ingest-time", required_argument, NULL, 0},
+    {"client-rate", required_argument, NULL, 0},
+    {"client-burst", required_argument, NULL, 0},
+    {"pipeline", no_argument, NULL, 0},
+    {"lockstep", no_argument, NULL, 0},
+    {"arenas", required_argument, NULL, 0},
+    {"arena-threads", required_argument, NULL, 0},
+    {"session-timeout", required_argument, NULL, 0},
     {0, 0, 0, 0}
 };
 
@@ -51,6 +86,84 @@ void printHelp()
     cout << "\t" << "--round-time <N>" << endl;
     cout << "\t\t" << _("set duration of one round to be <N> microseconds") << endl;
 
+    cout << "\t" << "--log-file <path>" << endl;
+    cout << "\t\t" << _("write game events into <path> instead of syslog") << endl;
+
+    cout << "\t" << "--log-level <N>" << endl;
+    cout << "\t\t" << _("log game events with syslog priority up to <N> (default 6), SIGUSR2 cycles the level") << endl;
+
+    cout << "\t" << "--stats <port|path>" << endl;
+    cout << "\t\t" << _("serve round statistics in Prometheus format on localhost <port> or unix socket <path>") << endl;
+
+    cout << "\t" << "--trace-file <path>" << endl;
+    cout << "\t\t" << _("record Chrome trace events and write them into <path>, SIGPROF stops and starts tracing") << endl;
+
+    cout << "\t" << "--seed <N>" << endl;
+    cout << "\t\t" << _("seed random placement of tanks with <N> (default current time)") << endl;
+
+    cout << "\t" << "--journal <path>" << endl;
+    cout << "\t\t" << _("record seed, placement and actions of every round into <path>, an existing journal is appended to") << endl;
+
+    cout << "\t" << "--replay <path>" << endl;
+    cout << "\t\t" << _("replay journal <path> as fast as possible and verify its final states, other options are ignored") << endl;
+
+    cout << "\t" << "--replay-engine <path>" << endl;
+    cout << "\t\t" << _("replay journal <path> by the embeddable engine instead of world and verify its final states") << endl;
+
+    cout << "\t" << "--archive <path>" << endl;
+    cout << "\t\t" << _("record seekable archive of games into <path>, read it by worldarchive program") << endl;
+
+    cout << "\t" << "--keyframe-interval <N>" << endl;
+    cout << "\t\t" << _("store full gameboard into archive every <N> rounds (default 1000)") << endl;
+
+    cout << "\t" << "--snapshot <path>" << endl;
+    cout << "\t\t" << _("write snapshot of the world into <path> periodically and on exit") << endl;
+
+    cout << "\t" << "--snapshot-interval <N>" << endl;
+    cout << "\t\t" << _("write snapshot every <N> rounds (default 100)") << endl;
+
+    cout << "\t" << "--restore <path>" << endl;
+    cout << "\t\t" << _("continue the game from snapshot <path> instead of starting a new one") << endl;
+
+    cout << "\t" << "--ingest-packets <N>" << endl;
+    cout << "\t\t" << _("receive at most <N> packets in one round, 0 is unlimited (default 4096)") << endl;
+
+    cout << "\t" << "--ingest-time <N>" << endl;
+    cout << "\t\t" << _("receive packets for at most <N> microseconds in one round, 0 is unlimited (default 10000)") << endl;
+
+    cout << "\t" << "--client-rate <N>" << endl;
+    cout << "\t\t" << _("ignore commands of a client sending more than <N> commands per second, 0 is unlimited (default 100)") << endl;
+
+    cout << "\t" << "--client-burst <N>" << endl;
+    cout << "\t\t" << _("allow bursts of <N> commands over the client rate (default 20)") << endl;
+
+    cout << "\t" << "--session-timeout <N>" << endl;
+    cout << "\t\t" << _("give tank of a client which sent no command for <N> rounds to a new client, 0 is never (default 1000)") << endl;
+
+    cout << "\t" << "--pipeline" << endl;
+    cout << "\t\t" << _("receive packets and print gameboard on their own threads while rounds are resolved") << endl;
+
+    cout << "\t" << "--lockstep" << endl;
+    cout << "\t\t" << _("finish round as soon as every client sent its command, round time is only its deadline") << endl;
+
+    cout << "\t" << "--arenas <N>" << endl;
+    cout << "\t\t" << _("host <N> independent arenas on one port, arena <I> prints gameboard into pipe <path>.<I>,") << endl;
+    cout << "\t\t" << _("client joins arena by sending \"@<I>\" first, cannot be combined with journal, archive,") << endl;
+    cout << "\t\t" << _("snapshots, pipeline and lockstep") << endl;
+
+    cout << "\t" << "--arena-threads <N>" << endl;
+    cout << "\t\t" << _("perform rounds of arenas on <N> threads (default number of CPUs)") << endl;
+
+    cout << "\t" << "--benchmark" << endl;
+    cout << "\t\t" << _("run headless benchmark with synthetic actions and print results as JSON,") << endl;
+    cout << "\t\t" << _("only --area-size, --green-tanks and --red-tanks are required") << endl;
+
+    cout << "\t" << "--rounds <N>" << endl;
+    cout << "\t\t" << _("number of benchmark rounds (default 10000)") << endl;
+
+    cout << "\t" << "--action-mix <M:F:I>" << endl;
+    cout << "\t\t" << _("ratio of move, fire and idle benchmark actions (default 50:1:49)") << endl;
+
     cout << "\t" << "-h, --help" << endl;
     cout << "\t\t" << _("shows this help") << endl << endl;
 }
@@ -59,6 +172,8 @@ void printHelp()
 
 volatile bool done = false;
 volatile bool restart = false;
+volatile bool cycleLogLevel = false;
+volatile bool toggleTrace = false;
 
 static void sigHandler(int signo)
 {
@@ -72,6 +187,12 @@ static void sigHandler(int signo)
     else if (signo == SIGUSR1) {
         restart = true;
     }
+    else if (signo == SIGUSR2) {
+        cycleLogLevel = true;
+    }
+    else if (signo == SIGPROF) {
+        toggleTrace = true;
+    }
     else {
         syslog(LOG_ERR, "Error: invalid signal");
     }
@@ -88,6 +209,8 @@ int setSigHandler()
         sigaction(SIGINT, &sigAction, NULL) != 0 ||
         sigaction(SIGTERM, &sigAction, NULL) != 0 ||
         sigaction(SIGUSR1, &sigAction, NULL) != 0 ||
+        sigaction(SIGUSR2, &sigAction, NULL) != 0 ||
+        sigaction(SIGPROF, &sigAction, NULL) != 0 ||
         sigaction(SIGPIPE, &sigAction, NULL) != 0) {
 
         syslog(LOG_ERR, "sigaction() failed: %s", strerror(errno));
@@ -106,13 +229,47 @@ struct worldOptions {
     bool daemonize = 0;
     std::string pipePath;
     useconds_t roundTime = 0;
+    std::string logPath;
+    int logLevel = LOG_INFO;
+    std::string statsAddress;
+    std::string tracePath;
+    unsigned int seed = (unsigned int) time(NULL);
+    std::string journalPath;
+    std::string replayPath;
+    bool replayEngine = false;
+    std::string snapshotPath;
+    unsigned int snapshotInterval = 100;
+    std::string restorePath;
+    unsigned int ingestPackets = 4096;
+    useconds_t ingestTime = 10000;
+    double clientRate = 100;
+    double clientBurst = 20;
+    unsigned int sessionTimeout = 1000;
+    bool pipeline = false;
+    bool lockstep = false;
+    unsigned int arenaCount = 0;
+    unsigned int arenaThreads = 0;
+    std::string archivePath;
+    unsigned int keyframeInterval = 1000;
+    bool benchmark = false;
+    unsigned int benchmarkRounds = 10000;
+    unsigned int moveRatio = 50;
+    unsigned int fireRatio = 1;
+    unsigned int idleRatio = 49;
 };
 
 bool checkOptions(struct worldOptions & options)
 {
     return !(options.areaX <= 0 || options.areaY <= 0 ||
             options.redCount < 0 || options.greenCount < 0 ||
-            (options.areaY * options.areaX <= options.redCount + options.greenCount));
+            (options.areaY * options.areaX <= options.redCount + options.greenCount) ||
+            options.logLevel < LOG_EMERG || options.logLevel > LOG_DEBUG ||
+            options.keyframeInterval == 0 || options.snapshotInterval == 0 ||
+            options.clientRate < 0 || options.clientBurst < 1 ||
+            (options.arenaCount > 0 && (!options.journalPath.empty() || !options.archivePath.empty() ||
+                                        !options.snapshotPath.empty() || !options.restorePath.empty() ||
+                                        options.pipeline || options.lockstep)) ||
+            options.moveRatio + options.fireRatio + options.idleRatio == 0);
 }
 
 bool parseOptions(int argc, char **argv, struct worldOptions & options)
@@ -146,6 +303,86 @@ bool parseOptions(int argc, char **argv, struct worldOptions & options)
             case 6: // --round-time
                 options.roundTime = atoi(optarg);
                 rndt = true;
+                break;
+            case 7: // --log-file
+                options.logPath = optarg;
+                break;
+            case 8: // --log-level
+                options.logLevel = atoi(optarg);
+                break;
+            case 9: // --stats
+                options.statsAddress = optarg;
+                break;
+            case 10: // --trace-file
+                options.tracePath = optarg;
+                break;
+            case 11: // --seed
+                options.seed = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 12: // --journal
+                options.journalPath = optarg;
+                break;
+            case 13: // --replay
+                options.replayPath = optarg;
+                return true;
+            case 14: // --archive
+                options.archivePath = optarg;
+                break;
+            case 15: // --keyframe-interval
+                options.keyframeInterval = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 16: // --benchmark
+                options.benchmark = true;
+                break;
+            case 17: // --rounds
+                options.benchmarkRounds = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 18: // --action-mix
+                if (sscanf(optarg, "%u:%u:%u", &options.moveRatio, &options.fireRatio, &options.idleRatio) != 3) {
+                    cout << _("invalid action mix") << endl;
+                    exit(1);
+                }
+                break;
+            case 19: // --replay-engine
+                options.replayPath = optarg;
+                options.replayEngine = true;
+                return true;
+            case 20: // --snapshot
+                options.snapshotPath = optarg;
+                break;
+            case 21: // --snapshot-interval
+                options.snapshotInterval = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 22: // --restore
+                options.restorePath = optarg;
+                break;
+            case 23: // --ingest-packets
+                options.ingestPackets = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 24: // --ingest-time
+                options.ingestTime = (useconds_t) strtoul(optarg, NULL, 10);
+                break;
+            case 25: // --client-rate
+                options.clientRate = atof(optarg);
+                break;
+            case 26: // --client-burst
+                options.clientBurst = atof(optarg);
+                break;
+            case 27: // --pipeline
+                options.pipeline = true;
+                break;
+            case 28: // --lockstep
+                options.lockstep = true;
+                break;
+            case 29: // --arenas
+                options.arenaCount = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 30: // --arena-threads
+                options.arenaThreads = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
+            case 31: // --session-timeout
+                options.sessionTimeout = (unsigned int) strtoul(optarg, NULL, 10);
+                break;
             default:
                 break;
             }
@@ -167,7 +404,7 @@ bool parseOptions(int argc, char **argv, struct worldOptions & options)
         }
     }
 
-    if (!area || !gcnt || !rcnt || !rndt || !ppth) {
+    if (!area || !gcnt || !rcnt || (!options.benchmark && (!rndt || !ppth))) {
         cout << _("Some required options were not provided") << endl;
         printHelp();
         exit(1);
@@ -185,6 +422,303 @@ void closePidFile(const char * path, int fd){
     }
 }
 
+/* Replay */
+
+/**
+ * Compare final state of Engine with the final state from the journal
+ */
+bool verifyEngineEnd(const Engine & engine, const JournalEnd & end)
+{
+    if (end.rounds != engine.getRoundCount()) {
+        return false;
+    }
+
+    size_t i = 0;
+    for (uint32_t id = 0; id < engine.getTankCount(); id++) {
+        if (!engine.isAlive(id)) {
+            continue;
+        }
+        if (i >= end.tanks.size() || end.tanks[i].id != id || end.tanks[i].x != engine.getX(id)
+            || end.tanks[i].y != engine.getY(id) || end.tanks[i].team != engine.getTeam(id)) {
+            return false;
+        }
+        i++;
+    }
+    return i == end.tanks.size();
+}
+
+/**
+ * Compute hash of gameboard of Engine as World computes it, see engine::hash
+ */
+uint64_t engineBoardHash(const Engine & simulation, int areaX)
+{
+    uint64_t hash = 0;
+    for (uint32_t id = 0; id < simulation.getTankCount(); id++) {
+        if (simulation.isAlive(id)) {
+            hash ^= engine::zobrist(id, (uint8_t) simulation.getTeam(id),
+                                    (uint64_t) simulation.getY(id) * areaX + simulation.getX(id));
+        }
+    }
+    return hash;
+}
+
+/**
+ * Add tanks of the game from journal into Engine
+ */
+void placeEngineTanks(Engine & engine, const JournalGame & game)
+{
+    for (const JournalTank & tank : game.tanks) {
+        if (engine.addTank(tank.team == GREEN ? GREEN : RED, tank.x, tank.y) != tank.id) {
+            throw std::runtime_error("tanks in journal are not numbered in order");
+        }
+    }
+}
+
+int replay(const std::string & path, bool useEngine)
+{
+    unsigned long games = 0;
+    unsigned long rounds = 0;
+    unsigned long mismatches = 0;
+    uint64_t checksum = 0;      //<< of final board hashes of all games, equal for all variants of replay
+    int areaX = 0;
+    std::unique_ptr<World> world;
+    std::unique_ptr<Engine> engine;
+    std::vector<uint8_t> actions;
+
+    auto start = std::chrono::steady_clock::now();
+    try {
+        JournalReader reader(path);
+        JournalGame game;
+        JournalRound round;
+        JournalEnd end;
+
+        JournalRecord record;
+        while (!done && (record = reader.read(game, round, end)) > JOURNAL_EOF) {
+            switch (record) {
+                case JOURNAL_GAME:
+                    world.reset();
+                    engine.reset();
+                    areaX = game.areaX;
+                    if (useEngine) {
+                        engine.reset(new Engine(game.areaX, game.areaY));
+                        placeEngineTanks(*engine, game);
+                        actions.assign(game.tanks.size(), NO_ACTION);
+                    } else {
+                        world.reset(new World(game));
+                        world->initFromJournal(game);
+                    }
+                    games++;
+                    break;
+
+                case JOURNAL_ROUND:
+                    if (world) {
+                        world->replayRound(round);
+                        rounds++;
+                    }
+                    if (engine) {
+                        for (const JournalAction & action : round.actions) {
+                            if (action.tankId < actions.size()) {
+                                actions[action.tankId] = action.action;
+                            }
+                        }
+                        engine->step(actions.data());
+                        std::fill(actions.begin(), actions.end(), NO_ACTION);
+                        rounds++;
+                    }
+                    break;
+
+                case JOURNAL_END:
+                    if (useEngine ? !engine || !verifyEngineEnd(*engine, end) : !world || !world->verifyJournalEnd(end)) {
+                        cout << _("game") << " " << games << ": " << _("final state differs from the journal") << endl;
+                        mismatches++;
+                    }
+                    checksum = checksum * 31 + (engine ? engineBoardHash(*engine, areaX)
+                                                : world ? world->getBoardHash() : 0);
+                    world.reset();
+                    engine.reset();
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        if (record == JOURNAL_ERROR) {
+            cout << _("journal is corrupted") << endl;
+            return 1;
+        }
+    } catch (const std::runtime_error & error) {
+        cout << error.what() << endl;
+        return 1;
+    }
+    world.reset();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cout << _("games") << ": " << games << ", " << _("rounds") << ": " << rounds
+         << ", " << _("seconds") << ": " << seconds
+         << ", " << _("rounds per second") << ": " << (seconds > 0 ? rounds / seconds : 0) << endl;
+    cout << _("mismatches") << ": " << mismatches << endl;
+    cout << _("board hash") << ": " << std::hex << std::setfill('0') << std::setw(16) << checksum << std::dec << endl;
+    return mismatches == 0 ? 0 : 2;
+}
+
+/* Benchmark */
+
+/**
+ * Get exact quantile of sorted values
+ */
+uint64_t quantile(const std::vector<uint64_t> & sorted, double q)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, (size_t) (q * sorted.size()))];
+}
+
+void printPhaseJson(const char *name, const Histogram & histogram, bool last = false)
+{
+    cout << "    \"" << name << "\": {\"p50\": " << histogram.valueAtQuantile(0.5)
+         << ", \"p99\": " << histogram.valueAtQuantile(0.99) << "}" << (last ? "" : ",") << endl;
+}
+
+/**
+ * Run rounds of headless world with synthetic actions and print results as JSON.
+ * The game is restarted (outside of measured time) whenever less than half of tanks survive,
+ * so the density of tanks stays close to the requested one.
+ */
+int benchmark(const struct worldOptions & options)
+{
+    JournalGame game = {options.areaX, options.areaY, options.redCount, options.greenCount, options.seed, {}};
+    std::mt19937 random(options.seed);
+    unsigned int mixTotal = options.moveRatio + options.fireRatio + options.idleRatio;
+    const Action moves[] = {MOVE_UP, MOVE_DOWN, MOVE_LEFT, MOVE_RIGHT};
+    const Action fires[] = {FIRE_UP, FIRE_DOWN, FIRE_LEFT, FIRE_RIGHT};
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(options.benchmarkRounds);
+    unsigned long games = 1;
+    size_t tankCount = (size_t) options.redCount + options.greenCount;
+    double seconds = 0;
+
+    try {
+        World world(game);
+        world.setBoardOutput("/dev/null");
+        world.init();
+
+        JournalRound round;
+        for (unsigned int i = 0; i < options.benchmarkRounds && !done; i++) {
+            if (world.getPlacement().size() * 2 < tankCount) {
+                world.init();
+                games++;
+            }
+
+            round.actions.clear();
+            for (uint32_t id = 0; id < tankCount; id++) {
+                unsigned int draw = random() % mixTotal;
+                if (draw < options.moveRatio) {
+                    round.actions.push_back(JournalAction{id, (uint8_t) moves[random() % 4]});
+                } else if (draw < options.moveRatio + options.fireRatio) {
+                    round.actions.push_back(JournalAction{id, (uint8_t) fires[random() % 4]});
+                }
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            world.replayRound(round);
+            auto duration = std::chrono::steady_clock::now() - start;
+            latencies.push_back((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+            seconds += std::chrono::duration<double>(duration).count();
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        const RoundStats & stats = world.getStats();
+
+        cout << "{" << endl;
+        cout << "  \"areaX\": " << options.areaX << "," << endl;
+        cout << "  \"areaY\": " << options.areaY << "," << endl;
+        cout << "  \"greenTanks\": " << options.greenCount << "," << endl;
+        cout << "  \"redTanks\": " << options.redCount << "," << endl;
+        cout << "  \"seed\": " << options.seed << "," << endl;
+        cout << "  \"actionMix\": {\"move\": " << options.moveRatio << ", \"fire\": " << options.fireRatio
+             << ", \"idle\": " << options.idleRatio << "}," << endl;
+        cout << "  \"rounds\": " << latencies.size() << "," << endl;
+        cout << "  \"games\": " << games << "," << endl;
+        cout << "  \"seconds\": " << seconds << "," << endl;
+        cout << "  \"roundsPerSecond\": " << (seconds > 0 ? latencies.size() / seconds : 0) << "," << endl;
+        cout << "  \"roundLatencyNs\": {\"p50\": " << quantile(latencies, 0.5)
+             << ", \"p99\": " << quantile(latencies, 0.99)
+             << ", \"p999\": " << quantile(latencies, 0.999)
+             << ", \"max\": " << (latencies.empty() ? 0 : latencies.back()) << "}," << endl;
+        cout << "  \"phaseLatencyNs\": {" << endl;
+        printPhaseJson("fire", stats.getPhase(PHASE_FIRE));
+        printPhaseJson("move", stats.getPhase(PHASE_MOVE));
+        printPhaseJson("print", stats.getPhase(PHASE_PRINT), true);
+        cout << "  }," << endl;
+        cout << "  \"events\": {\"actions\": " << stats.getTotal(COUNTER_ACTIONS)
+             << ", \"hits\": " << stats.getTotal(COUNTER_HITS)
+             << ", \"crashes\": " << stats.getTotal(COUNTER_CRASHES)
+             << ", \"rollOffs\": " << stats.getTotal(COUNTER_ROLL_OFFS) << "}" << endl;
+        cout << "}" << endl;
+    } catch (const std::runtime_error & error) {
+        // Standard output carries only the JSON document
+        syslog(LOG_ERR, "benchmark failed: %s", error.what());
+        std::cerr << error.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+/* Arenas */
+
+/**
+ * Handle signals which do not depend on what the process hosts
+ */
+void handleSignalRequests()
+{
+    if (cycleLogLevel) {
+        EventLog::setLevel(EventLog::getLevel() < LOG_DEBUG ? EventLog::getLevel() + 1 : LOG_ERR);
+        syslog(LOG_INFO, "log level set to %d", EventLog::getLevel());
+        cycleLogLevel = false;
+    }
+    if (toggleTrace) {
+        if (Trace::isEnabled()) {
+            Trace::stop();
+        } else {
+            Trace::start();
+        }
+        toggleTrace = false;
+    }
+}
+
+/**
+ * Run rounds of all arenas until the process is asked to terminate
+ * @throw runtime_error when some error occurs
+ */
+void hostArenas(const struct worldOptions & options)
+{
+    // Spectator leaving one arena must not terminate the others, pipe of the arena reports EPIPE instead
+    signal(SIGPIPE, SIG_IGN);
+
+    ArenaHost host(options.arenaCount, options.areaX, options.areaY, options.redCount, options.greenCount,
+                   options.pipePath, options.roundTime, options.seed, options.arenaThreads);
+    host.limitIngestion(options.ingestPackets, options.ingestTime);
+    host.limitClients(options.clientRate, options.clientBurst);
+    host.setSessionTimeout(options.sessionTimeout);
+
+    std::unique_ptr<StatsServer> statsServer;
+    if (!options.statsAddress.empty()) {
+        statsServer.reset(new StatsServer(host.getStats(), options.statsAddress, EventLog::droppedRecords));
+    }
+
+    host.init();
+    while (!done) {
+        handleSignalRequests();
+        if (restart) {
+            host.requestRestart();
+            restart = false;
+        }
+        host.performRound();
+    }
+}
+
 /* Main */
 
 int main(int argc, char *argv[])
@@ -201,6 +735,20 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    if (!options.replayPath.empty()) {
+        if (setSigHandler() != 0) {
+            return -1;
+        }
+        return replay(options.replayPath, options.replayEngine);
+    }
+
+    if (options.benchmark) {
+        if (setSigHandler() != 0) {
+            return -1;
+        }
+        return benchmark(options);
+    }
+
     /* Check if there is another instance of world running */
 
     const char *worldPidPath = "world.pid";
@@ -249,11 +797,20 @@ int main(int argc, char *argv[])
 
     /* Create Pipe if doesn't exist */
 
-    if (access(options.pipePath.c_str(), F_OK) != 0) {
-        if (mkfifo(options.pipePath.c_str(), S_IRUSR | S_IWUSR) != 0) {
-            syslog(LOG_ERR, "mkfifo() with name %s failed: %s",options.pipePath.c_str(), strerror(errno));
-            closePidFile(worldPidPath, worldFD);
-            return 1;
+    std::vector<std::string> pipePaths;
+    for (unsigned int i = 0; i < options.arenaCount; i++) {
+        pipePaths.push_back(ArenaHost::pipePath(options.pipePath, i));
+    }
+    if (options.arenaCount == 0) {
+        pipePaths.push_back(options.pipePath);
+    }
+    for (const std::string & pipePath : pipePaths) {
+        if (access(pipePath.c_str(), F_OK) != 0) {
+            if (mkfifo(pipePath.c_str(), S_IRUSR | S_IWUSR) != 0) {
+                syslog(LOG_ERR, "mkfifo() with name %s failed: %s", pipePath.c_str(), strerror(errno));
+                closePidFile(worldPidPath, worldFD);
+                return 1;
+            }
         }
     }
 
@@ -267,26 +824,68 @@ int main(int argc, char *argv[])
     /* Run game */
 
     try {
+        EventLog::start(options.logPath, options.logLevel);
+        Trace::setThreadName("world");
+        Trace::setOutput(options.tracePath);
+        Trace::start();
+
+        if (options.arenaCount > 0) {
+            hostArenas(options);
+            Trace::stop();
+            EventLog::stop();
+            closePidFile(worldPidPath, worldFD);
+            return 0;
+        }
+
         World world(options.areaX, options.areaY, options.redCount,
-                    options.greenCount, options.pipePath, options.roundTime);
+                    options.greenCount, options.pipePath, options.roundTime, options.seed);
+        if (!options.journalPath.empty()) {
+            world.recordJournal(options.journalPath);
+        }
+        if (!options.archivePath.empty()) {
+            world.recordArchive(options.archivePath, options.keyframeInterval);
+        }
+        if (!options.snapshotPath.empty()) {
+            world.recordSnapshots(options.snapshotPath, options.snapshotInterval);
+        }
+        world.limitIngestion(options.ingestPackets, options.ingestTime);
+        world.limitClients(options.clientRate, options.clientBurst);
+        world.setLockstep(options.lockstep);
+        world.setSessionTimeout(options.sessionTimeout);
+
+        std::unique_ptr<StatsServer> statsServer;
+        if (!options.statsAddress.empty()) {
+            statsServer.reset(new StatsServer(world.getStats(), options.statsAddress, EventLog::droppedRecords));
+        }
 
-        world.init();
+        if (!options.restorePath.empty()) {
+            world.restore(readSnapshot(options.restorePath));
+        } else {
+            world.init();
+        }
+        if (options.pipeline) {
+            world.startPipeline();
+        }
 
         while (!done) {
+            handleSignalRequests();
             if (restart) {
-                world.init();
+                world.requestRestart();
                 restart = false;
-            } else {
-                world.performRound();
             }
+            world.performRound();
         }
     } catch(std::runtime_error error) {
         syslog(LOG_ERR, "World threw expection: %s", error.what());
 
+        Trace::stop();
+        EventLog::stop();
         closePidFile(worldPidPath, worldFD);
         return -1;
     }
 
+    Trace::stop();
+    EventLog::stop();
     closePidFile(worldPidPath, worldFD);
     return 0;
 }
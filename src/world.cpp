@@ -1,14 +1,19 @@
 #include "world.h"
+#include "eventlog.h"
 #include "tank.h"
+#include "trace.h"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <syslog.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
@@ -17,113 +22,639 @@
 #include <map>
 #include <stdexcept>
 #include <system_error>
+#include <unordered_map>
 
 using std::runtime_error;
 using std::pair;
 
 const char* IOT_PORT = "1337";
 
+// Tanks built or torn down by restart thread between two ticks, keeps one slice shorter than a sleep phase
+const int RESTART_SLICE = 256;
+
 World::World(int areaX,
              int areaY,
              int redCount,
              int greenCount,
              std::string & namedPipe,
-             useconds_t roundTime)
+             useconds_t roundTime,
+             unsigned int seed)
     : areaX(areaX), areaY(areaY), redCount(redCount), greenCount(greenCount),
-      roundTime(roundTime), roundCount(0)
+      roundTime(roundTime), roundCount(0), seed(seed), random(seed), sd_listen(-1), inbox(nullptr), ingestPackets(0), ingestTime(0),
+      frame(nullptr), lockstep(false), lockstepWait(0), submittedCount(0), sessionTimeout(0),
+      current(new WorldGeneration(areaX, areaY)), restartBusy(false), restartRequested(false),
+      restartGranted(false), restartUnpaced(false),
+      journal(nullptr), archive(nullptr), replaying(false), snapshotWriter(nullptr), snapshotInterval(0),
+      restored(false), boardHash(0)
 {
-    srand((unsigned int) time(NULL));
-
     this->namedPipe.open(namedPipe);
 
     if (areaX < 0 || areaY < 0 || redCount < 0 || greenCount < 0 || (areaY * areaX < redCount + greenCount)) {
         throw runtime_error("Creating world failed: invalid parameters");
     }
 
-    setListenSocket();
+    sd_listen = openListenSocket();
 }
 
-void World::init()
+World::World(int areaX,
+             int areaY,
+             int redCount,
+             int greenCount,
+             const std::string & namedPipe,
+             useconds_t roundTime,
+             unsigned int seed,
+             int sd_shared,
+             SpscQueue<ClientPacket> *inbox)
+    : areaX(areaX), areaY(areaY), redCount(redCount), greenCount(greenCount), pipePath(namedPipe),
+      roundTime(roundTime), roundCount(0), seed(seed), random(seed), sd_listen(sd_shared), inbox(inbox), ingestPackets(0), ingestTime(0),
+      frame(nullptr), lockstep(false), lockstepWait(0), submittedCount(0), sessionTimeout(0),
+      current(new WorldGeneration(areaX, areaY)), restartBusy(false), restartRequested(false),
+      restartGranted(false), restartUnpaced(false),
+      journal(nullptr), archive(nullptr), replaying(false), snapshotWriter(nullptr), snapshotInterval(0),
+      restored(false), boardHash(0)
 {
+    if (areaX < 0 || areaY < 0 || redCount < 0 || greenCount < 0 || (areaY * areaX < redCount + greenCount)) {
+        throw runtime_error("Creating world failed: invalid parameters");
+    }
+}
+
+World::World(const JournalGame & game)
+    : areaX(game.areaX), areaY(game.areaY), redCount(game.redCount), greenCount(game.greenCount),
+      roundTime(0), roundCount(0), seed(game.seed), random(game.seed), sd_listen(-1), inbox(nullptr), ingestPackets(0), ingestTime(0),
+      frame(nullptr), lockstep(false), lockstepWait(0), submittedCount(0), sessionTimeout(0),
+      current(new WorldGeneration(game.areaX, game.areaY)), restartBusy(false), restartRequested(false),
+      restartGranted(false), restartUnpaced(false),
+      journal(nullptr), archive(nullptr), replaying(true), snapshotWriter(nullptr), snapshotInterval(0),
+      restored(false), boardHash(0)
+{
+    if (areaX < 0 || areaY < 0 || redCount < 0 || greenCount < 0 || (areaY * areaX < redCount + greenCount)) {
+        throw runtime_error("Creating world failed: invalid parameters");
+    }
+}
+
+World::~World()
+{
+    pipeline.reset();
+    if (snapshotWriter != nullptr) {
+        snapshotWriter->submit(snapshot());
+        delete snapshotWriter;
+    }
+    if (journal != nullptr) {
+        journalGameEnd();
+        delete journal;
+    }
+    delete archive;
+    if (sd_listen != -1 && inbox == nullptr) {
+        close(sd_listen);
+    }
+    cancelRestart();
     clearTanks();
-    roundCount = 0;
+}
+
+void World::init()
+{
+    cancelRestart();
+
+    std::unique_ptr<WorldGeneration> generation;
     try {
-        createTanks(Team::GREEN, greenCount);
-        createTanks(Team::RED, redCount);
+        generation = buildGeneration();
     }
     catch (runtime_error error) {
         throw runtime_error(std::string("World initialization failed: ") + error.what());
     }
+    startGeneration(generation);
+    teardownGeneration(*generation);
 
     printGameBoard();
-    usleep(roundTime);
-    waitForAllTanks();
+    if (inbox == nullptr) {
+        usleep(roundTime);
+    }
+}
+
+void World::requestRestart()
+{
+    restartRequested = true;
 }
 
 void World::performRound()
 {
+    RoundStats::Clock::time_point start = RoundStats::Clock::now();
+
+    advanceRestart();
+
     roundCount++;
-    syslog(LOG_INFO, "round num %d started", roundCount);
+    EventLog::log(LOG_INFO, ROUND_STARTED, roundCount);
+    if (pipeline != nullptr) {
+        frame = &pipeline->acquireFrame();
+    }
     receiveMessages();
+    if (sessionTimeout != 0) {
+        expireSessions();
+    }
+    RoundStats::Clock::time_point received = RoundStats::Clock::now();
+    stats.recordPhase(PHASE_RECEIVE, received - start);
+    Trace::span("receiveMessages", "round", start, received);
+
     performActions();
+    RoundStats::Clock::time_point performed = RoundStats::Clock::now();
+
+    if (pipeline != nullptr) {
+        fillFrame(*frame);
+        pipeline->publishFrame();
+        frame = nullptr;
+    } else {
+        printGameBoard();
+    }
+    RoundStats::Clock::time_point printed = RoundStats::Clock::now();
+    if (pipeline == nullptr) {
+        stats.recordPhase(PHASE_PRINT, printed - performed);
+    }
+    stats.recordPhase(PHASE_TICK, printed - start);
+    Trace::span("printGameBoard", "round", performed, printed);
+    grantRestartSlice();
+
+    if (snapshotWriter != nullptr && roundCount % snapshotInterval == 0) {
+        snapshotWriter->submit(snapshot());
+    }
+
+    if (inbox != nullptr) {
+        // Host of arena waits for the end of round
+    } else if (lockstep) {
+        waitForClients(start + std::chrono::microseconds(roundTime));
+    } else {
+        usleep(roundTime);
+    }
+    RoundStats::Clock::time_point slept = RoundStats::Clock::now();
+    stats.recordPhase(PHASE_SLEEP, slept - printed);
+    stats.finishRound(printed - start > std::chrono::microseconds(roundTime));
+    Trace::span("sleep", "round", printed, slept);
+    Trace::span("round", "round", start, slept);
+}
+
+const RoundStats & World::getStats() const
+{
+    return stats;
+}
+
+void World::recordJournal(const std::string & path)
+{
+    journal = new JournalWriter(path);
+}
+
+void World::recordArchive(const std::string & path, unsigned int keyframeInterval)
+{
+    archive = new ArchiveWriter(path, areaX, areaY, redCount, greenCount, keyframeInterval);
+}
+
+void World::recordSnapshots(const std::string & path, unsigned int interval)
+{
+    snapshotWriter = new SnapshotWriter(path);
+    snapshotInterval = interval;
+}
+
+void World::limitIngestion(unsigned int packets, useconds_t time)
+{
+    ingestPackets = packets;
+    ingestTime = time;
+}
+
+void World::limitClients(double rate, double burst)
+{
+    clientBuckets.setRate(rate, burst);
+}
+
+void World::setLockstep(bool lockstep)
+{
+    this->lockstep = lockstep;
+}
+
+void World::setSessionTimeout(unsigned int rounds)
+{
+    sessionTimeout = rounds;
+}
+
+void World::takeDepartedClients(std::vector<struct sockaddr_in> & clients)
+{
+    clients.insert(clients.end(), departedClients.begin(), departedClients.end());
+    departedClients.clear();
+}
+
+void World::countInboxOverflow()
+{
+    stats.count(COUNTER_INBOX_FULL);
+}
+
+void World::startPipeline()
+{
+    pipeline.reset(new RoundPipeline(sd_listen, namedPipe, areaX, areaY, stats));
+}
+
+WorldSnapshot World::snapshot() const
+{
+    WorldSnapshot snapshot = {areaX, areaY, redCount, greenCount, seed, roundCount, {}, {}};
+
+    // Destroyed tanks are kept while their clients are bound, so the clients do not get new tanks
+    for (TankId id = 0; id < current->tanks.size(); id++) {
+        if (!current->tanks.isOnBoard(id) && !current->tanks.bound[id]) {
+            continue;
+        }
+        SnapshotTank tank = {id, current->tanks.x[id], current->tanks.y[id], current->tanks.team[id], 0, 0, 0};
+        if (current->tanks.isOnBoard(id)) {
+            tank.flags |= SNAPSHOT_ON_BOARD;
+        }
+        if (current->tanks.bound[id]) {
+            tank.flags |= SNAPSHOT_BOUND;
+            tank.addr = current->tanks.client[id].sin_addr.s_addr;
+            tank.port = current->tanks.client[id].sin_port;
+        }
+        snapshot.tanks.push_back(tank);
+    }
+
+    for (TankId id : current->freeTanks) {
+        if (current->tanks.isOnBoard(id)) {
+            snapshot.freeTanks.push_back(id);
+        }
+    }
+    return snapshot;
+}
+
+void World::restore(const WorldSnapshot & snapshot)
+{
+    if (snapshot.areaX != areaX || snapshot.areaY != areaY
+        || snapshot.redCount != redCount || snapshot.greenCount != greenCount) {
+        syslog(LOG_ERR, "snapshot of %dx%d world with %d red and %d green tanks does not match the world",
+               snapshot.areaX, snapshot.areaY, snapshot.redCount, snapshot.greenCount);
+        throw runtime_error("Restoring world failed: snapshot does not match parameters");
+    }
+
+    TankId tankCount = (TankId) (redCount + greenCount);
+    std::vector<JournalTank> placement;
+    for (const SnapshotTank & tank : snapshot.tanks) {
+        if (tank.id >= tankCount) {
+            syslog(LOG_ERR, "snapshot has tank %u of %u tanks", tank.id, tankCount);
+            throw runtime_error("Restoring world failed: tank id out of range");
+        }
+        if (tank.flags & SNAPSHOT_ON_BOARD) {
+            placement.push_back(JournalTank{tank.id, tank.x, tank.y, tank.team});
+        }
+    }
+    // Only tanks of clients get threads, the others get them when a client takes them
+    initFromPlacement(placement, snapshot.round, false);
+    restored = true;
+
+    try {
+        for (const SnapshotTank & tank : snapshot.tanks) {
+            if (!(tank.flags & SNAPSHOT_BOUND)) {
+                continue;
+            }
+
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof addr);
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = tank.addr;
+            addr.sin_port = tank.port;
+
+            if (tank.flags & SNAPSHOT_ON_BOARD) {
+                bindClient(tank.id, addr);
+                current->active.push_back(tank.id);
+                clientBuckets.reset(tank.id, TokenBuckets::Clock::now());
+            } else {
+                // Destroyed tank keeps its client, but it never acts again
+                current->tanks.addRemoved(tank.id, tank.team == GREEN ? GREEN : RED, nullptr);
+                current->tanks.bind(tank.id, addr);
+                current->addrToTank[addr] = tank.id;
+                startSession(tank.id);
+            }
+        }
+    }
+    catch (const runtime_error & error) {
+        throw runtime_error(std::string("Restoring world failed: ") + error.what());
+    }
+
+    current->freeTanks.clear();
+    for (TankId id : snapshot.freeTanks) {
+        if (id < current->tanks.size() && current->tanks.isOnBoard(id)) {
+            current->freeTanks.push_back(id);
+        }
+    }
+
     printGameBoard();
-    usleep(roundTime);
 }
 
-void World::clearTanks()
+void World::initFromJournal(const JournalGame & game)
+{
+    initFromPlacement(game.tanks, 0);
+}
+
+void World::initFromPlacement(const std::vector<JournalTank> & placement, unsigned int round, bool threads)
+{
+    cancelRestart();
+
+    std::unique_ptr<WorldGeneration> generation(new WorldGeneration(areaX, areaY));
+    try {
+        for (const JournalTank & tank : placement) {
+            if (tank.x < 0 || tank.x >= areaX || tank.y < 0 || tank.y >= areaY) {
+                throw runtime_error("tank out of gameboard");
+            }
+            createTankAt(*generation, tank.team == GREEN ? GREEN : RED, tank.id, tank.x, tank.y, threads);
+        }
+    }
+    catch (const runtime_error & error) {
+        teardownGeneration(*generation);
+        throw runtime_error(std::string("World initialization failed: ") + error.what());
+    }
+    waitForAllTanks(*generation);
+
+    current.swap(generation);
+    teardownGeneration(*generation);
+    roundCount = round;
+    boardHash = engine::hash(current->tanks.state());
+    replayActions.assign(current->tanks.size(), NO_ACTION);
+    replayTanks.clear();
+}
+
+void World::setBoardOutput(const std::string & path)
+{
+    namedPipe.open(path);
+    if (!namedPipe.is_open()) {
+        syslog(LOG_ERR, "opening board output %s failed", path.c_str());
+        throw runtime_error("Opening board output failed");
+    }
+}
+
+void World::replayRound(const JournalRound & round)
 {
-    for (auto row : mapToTank) {
-        for (auto tank : row.second) {
-            tank.second->markAsDestroyed();
+    RoundStats::Clock::time_point start = RoundStats::Clock::now();
+
+    roundCount++;
+    for (const JournalAction & action : round.actions) {
+        if (action.tankId < replayActions.size() && replayActions[action.tankId] == NO_ACTION) {
+            replayActions[action.tankId] = (Action) action.action;
+            replayTanks.push_back(action.tankId);
         }
     }
 
-    Tank::notifyAllTanks();
+    performActions();
+    for (TankId id : replayTanks) {
+        replayActions[id] = NO_ACTION;
+    }
+    replayTanks.clear();
+    RoundStats::Clock::time_point performed = RoundStats::Clock::now();
 
-    for (Tank* t : tanks)
-        delete t;
+    if (namedPipe.is_open()) {
+        printGameBoard();
+        stats.recordPhase(PHASE_PRINT, RoundStats::Clock::now() - performed);
+    }
+    stats.recordPhase(PHASE_TICK, RoundStats::Clock::now() - start);
+    stats.finishRound(false);
+}
+
+bool World::verifyJournalEnd(const JournalEnd & end) const
+{
+    if (end.rounds != roundCount) {
+        return false;
+    }
+
+    std::vector<JournalTank> placement = getPlacement();
+    if (placement.size() != end.tanks.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < placement.size(); i++) {
+        if (placement[i].id != end.tanks[i].id || placement[i].x != end.tanks[i].x
+            || placement[i].y != end.tanks[i].y || placement[i].team != end.tanks[i].team) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<JournalTank> World::getPlacement() const
+{
+    std::vector<JournalTank> placement;
+    for (TankId id = 0; id < current->tanks.size(); id++) {
+        if (current->tanks.isOnBoard(id)) {
+            placement.push_back(JournalTank{id, current->tanks.x[id], current->tanks.y[id], current->tanks.team[id]});
+        }
+    }
+    return placement;
+}
+
+void World::journalGameEnd()
+{
+    if (current->tanks.size() == 0 || restored) {
+        return;
+    }
+    JournalEnd end = {roundCount, getPlacement()};
+    journal->writeEnd(end);
+}
+
+void World::clearTanks()
+{
+    teardownGeneration(*current);
+}
+
+void World::teardownGeneration(WorldGeneration & generation, bool paced)
+{
+    TankStore & tanks = generation.tanks;
+    for (TankId first = 0; first < tanks.size(); first += RESTART_SLICE) {
+        if (paced && first > 0) {
+            waitForRestartSlice();
+        }
+        TankId last = std::min(tanks.size(), first + (TankId) RESTART_SLICE);
+        for (TankId id = first; id < last; id++) {
+            if (tanks.thread[id] != nullptr) {
+                tanks.thread[id]->markAsDestroyed()->notify();
+            }
+        }
+        for (TankId id = first; id < last; id++) {
+            delete tanks.thread[id];
+        }
+    }
 
     tanks.clear();
-    freeTanks.clear();
-    addrToTank.clear();
-    mapToTank.clear();
+    generation.freeTanks.clear();
+    generation.addrToTank.clear();
+    generation.active.clear();
+    generation.sessions.clear();
+    generation.lastCommand.clear();
 }
 
-Tank *World::createTank(Team team)
+std::unique_ptr<WorldGeneration> World::buildGeneration(bool paced)
 {
-    Tank *newTank = nullptr;
+    std::unique_ptr<WorldGeneration> generation(new WorldGeneration(areaX, areaY));
+    try {
+        createTanks(*generation, Team::GREEN, greenCount, paced);
+        createTanks(*generation, Team::RED, redCount, paced);
+    }
+    catch (const runtime_error & error) {
+        teardownGeneration(*generation);
+        throw;
+    }
+    waitForAllTanks(*generation);
+    return generation;
+}
+
+void World::startGeneration(std::unique_ptr<WorldGeneration> & generation)
+{
+    if (journal != nullptr) {
+        journalGameEnd();
+    }
+    if (archive != nullptr) {
+        archive->finishGame();
+    }
+
+    current.swap(generation);
+    roundCount = 0;
+    restored = false;
+    boardHash = engine::hash(current->tanks.state());
+
+    if (replaying) {
+        replayActions.assign(current->tanks.size(), NO_ACTION);
+        replayTanks.clear();
+    }
+
+    if (journal != nullptr) {
+        JournalGame game = {areaX, areaY, redCount, greenCount, seed, getPlacement()};
+        journal->writeGame(game);
+    }
+}
+
+void World::advanceRestart()
+{
+    if (restartBusy) {
+        return;
+    }
+    if (restartThread.joinable()) {
+        restartThread.join();
+    }
+
+    if (nextGeneration) {
+        // Only pointers are swapped, threads of the previous game are stopped in background
+        startGeneration(nextGeneration);
+        oldGeneration = std::move(nextGeneration);
+        restartBusy = true;
+        restartGranted = false;
+        restartThread = std::thread([this] {
+            Trace::setThreadName("restart");
+            teardownGeneration(*oldGeneration, true);
+            oldGeneration.reset();
+            restartBusy = false;
+        });
+    } else if (restartRequested) {
+        restartRequested = false;
+        restartBusy = true;
+        restartGranted = false;
+        restartThread = std::thread([this] {
+            Trace::setThreadName("restart");
+            try {
+                nextGeneration = buildGeneration(true);
+            }
+            catch (runtime_error & error) {
+                syslog(LOG_ERR, "Building next game failed: %s", error.what());
+            }
+            restartBusy = false;
+        });
+    }
+}
+
+void World::cancelRestart()
+{
+    if (restartThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(restartMutex);
+            restartUnpaced = true;
+        }
+        restartSlice.notify_one();
+        restartThread.join();
+        restartUnpaced = false;
+    }
+    restartBusy = false;
+    restartRequested = false;
+    if (nextGeneration) {
+        teardownGeneration(*nextGeneration);
+        nextGeneration.reset();
+    }
+}
+
+void World::grantRestartSlice()
+{
+    if (!restartBusy) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(restartMutex);
+        restartGranted = true;
+    }
+    restartSlice.notify_one();
+}
+
+void World::waitForRestartSlice()
+{
+    std::unique_lock<std::mutex> lock(restartMutex);
+    restartSlice.wait(lock, [this] { return restartGranted || restartUnpaced; });
+    restartGranted = false;
+}
+
+TankId World::createTank(WorldGeneration & generation, Team team)
+{
+    TankStore & tanks = generation.tanks;
+
+    // Find random Y with a free field
+    int y = (int) (random() % (unsigned int) areaY);
+    while (tanks.isRowFull(y)) {
+        y = (int) (random() % (unsigned int) areaY);
+    }
+
+    // Find random X
+    int x = (int) (random() % (unsigned int) areaX);
+    while (tanks.at(x, y) != -1) {
+        x = (int) (random() % (unsigned int) areaX);
+    }
+
+    return createTankAt(generation, team, tanks.size(), x, y);
+}
+
+TankId World::createTankAt(WorldGeneration & generation, Team team, TankId id, int x, int y, bool threaded)
+{
+    Tank *thread = nullptr;
 
     try {
-        newTank = new Tank(team);
+        if (threaded) {
+            thread = new Tank();
+        }
     }
-    catch (runtime_error error) {
+    catch (const runtime_error & error) {
         syslog(LOG_ERR, "Creating new tank failed: %s", error.what());
         throw runtime_error(std::string("Creating new tank failed: ") + error.what());
     }
 
-    // Find random Y
-    auto &row = mapToTank[abs(rand() % areaY)];
-    while (row.size() - areaX - 1 == 0) {
-        row = mapToTank[abs(rand() % areaY)];
+    try {
+        generation.tanks.add(id, team, x, y, thread);
+    }
+    catch (const runtime_error & error) {
+        if (thread != nullptr) {
+            delete thread->markAsDestroyed();
+        }
+        throw runtime_error(std::string("Creating new tank failed: ") + error.what());
     }
 
-    // Find random X
-    while (! (row.insert(pair<int, Tank *>(abs(rand() % areaX), newTank))).second) { }
-
-    freeTanks.push_back(newTank);
-    tanks.push_back(newTank);
-    return newTank;
+    generation.freeTanks.push_back(id);
+    return id;
 }
 
-void World::createTanks(Team team, int count)
+void World::createTanks(WorldGeneration & generation, Team team, int count, bool paced)
 {
     for (int i = 0; i < count; ++i) {
-        createTank(team);
+        if (paced && i > 0 && i % RESTART_SLICE == 0) {
+            waitForRestartSlice();
+        }
+        createTank(generation, team);
     }
 }
 
-void World::setListenSocket()
+int World::openListenSocket()
 {
+    int sd_listen = -1;
     struct addrinfo hints;
     struct addrinfo* server_info;
     struct addrinfo* p;
@@ -161,48 +692,52 @@ void World::setListenSocket()
     }
 
     freeaddrinfo(server_info);
+    return sd_listen;
 }
 
 void World::receiveMessages()
 {
-    struct sockaddr_storage from;
-    char buf[2];
-    socklen_t fromlen = sizeof from;
-    while ((recvfrom(sd_listen, buf, 2, MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen)) != -1) {
-        struct sockaddr_in addr = *(struct sockaddr_in*)&from;
-        Tank* tank = addrToTank[addr];
-
-        if (tank == nullptr) {
-
-            /* assign tank */
-            while (freeTanks.size() > 0) {
-                tank = freeTanks.back();
-                freeTanks.pop_back();
-                if (!tank->isDestroyed())
-                    break;
+    ClientPacket packet;
+    RoundStats::Clock::time_point start = RoundStats::Clock::now();
+    RoundStats::Clock::time_point now = start;
+    unsigned int received = 0;
+
+    // Flood of packets must not stop the round, packets over budget wait for the next round
+    while (true) {
+        if ((ingestPackets != 0 && received == ingestPackets)
+            || (ingestTime != 0 && now - start >= std::chrono::microseconds(ingestTime))) {
+            if (hasPendingPacket()) {
+                stats.count(COUNTER_DEFERRED);
             }
-
-            if (tank == nullptr || tank->isDestroyed()) {
-                syslog(LOG_INFO, "no more tanks for clients");
-                continue;
+            return;
+        }
+        if (pipeline != nullptr) {
+            if (!pipeline->receive(packet)) {
+                return;
             }
-
-            tank->setSocket((struct sockaddr*)&from, fromlen);
-            addrToTank[addr] = tank;
-            tank->setNextAction(buf);
-            if (sendto(sd_listen, buf, 2, 0, (struct sockaddr*)&from, fromlen) == -1) {
-                syslog(LOG_ERR, "sendto() failed: %s", strerror(errno));
+        } else if (inbox != nullptr) {
+            if (!inbox->pop(packet)) {
+                return;
             }
-
-        } else if (tank->isDestroyed()) {
-            continue;
-
         } else {
-            tank->setNextAction(buf);
-            if (sendto(sd_listen, buf, 2, 0, (struct sockaddr*)&from, fromlen) == -1) {
-                syslog(LOG_ERR, "sendto() failed: %s", strerror(errno));
+            socklen_t fromlen = sizeof packet.from;
+            if (recvfrom(sd_listen, packet.command, 2, MSG_DONTWAIT, (struct sockaddr*)&packet.from, &fromlen) == -1) {
+                break;
             }
         }
+        received++;
+        if (ingestTime != 0 || clientBuckets.isLimited()) {
+            now = RoundStats::Clock::now();
+        }
+
+        if (!handlePacket(packet, now)) {
+            continue;
+        }
+        if (frame != nullptr) {
+            frame->echoes.push_back(packet);
+        } else if (sendto(sd_listen, packet.command, 2, 0, (struct sockaddr*)&packet.from, sizeof packet.from) == -1) {
+            syslog(LOG_ERR, "sendto() failed: %s", strerror(errno));
+        }
     }
 
     if (errno != EWOULDBLOCK && errno != EAGAIN) {
@@ -211,21 +746,208 @@ void World::receiveMessages()
     }
 }
 
+bool World::hasPendingPacket() const
+{
+    if (pipeline != nullptr) {
+        return pipeline->hasPacket();
+    }
+    if (inbox != nullptr) {
+        return !inbox->isEmpty();
+    }
+    char command[2];
+    return recv(sd_listen, command, sizeof command, MSG_PEEK | MSG_DONTWAIT) != -1;
+}
+
+bool World::handlePacket(const ClientPacket & packet, RoundStats::Clock::time_point now)
+{
+    auto binding = current->addrToTank.find(packet.from);
+    stats.count(COUNTER_PACKETS);
+
+    if (binding == current->addrToTank.end()) {
+
+        /* assign tank */
+        TankId id = 0;
+        bool found = false;
+        while (current->freeTanks.size() > 0 && !found) {
+            id = current->freeTanks.back();
+            current->freeTanks.pop_back();
+            found = current->tanks.isOnBoard(id);
+        }
+
+        if (!found) {
+            stats.count(COUNTER_DROPPED);
+            EventLog::log(LOG_INFO, NO_FREE_TANK);
+            return false;
+        }
+
+        bindClient(id, packet.from);
+        current->active.push_back(id);
+        clientBuckets.reset(id, now);
+        clientBuckets.take(id, now);
+        current->tanks.thread[id]->setNextAction(packet.command);
+        markSubmitted(id);
+        return true;
+
+    }
+
+    if (sessionTimeout != 0) {
+        current->lastCommand[binding->second] = current->sessions.now();
+    }
+    if (!current->tanks.isOnBoard(binding->second)) {
+        stats.count(COUNTER_DROPPED);
+        return false;
+
+    } else if (!clientBuckets.take(binding->second, now)) {
+        // Ignored command is not echoed, so the client sees it as lost
+        stats.count(COUNTER_THROTTLED);
+        return false;
+    }
+
+    current->tanks.thread[binding->second]->setNextAction(packet.command);
+    markSubmitted(binding->second);
+    return true;
+}
+
+void World::startTankThread(TankId id)
+{
+    Tank *thread = new Tank();
+    // Thread is ready after its start, the next wait is for its first action
+    thread->waitForTank();
+    current->tanks.thread[id] = thread;
+}
+
+void World::bindClient(TankId id, const struct sockaddr_in & addr)
+{
+    if (current->tanks.thread[id] == nullptr) {
+        startTankThread(id);
+    }
+    current->tanks.thread[id]->setSocket((struct sockaddr*)&addr, sizeof addr);
+    current->tanks.bind(id, addr);
+    current->addrToTank[addr] = id;
+    startSession(id);
+}
+
+void World::startSession(TankId id)
+{
+    if (sessionTimeout == 0) {
+        return;
+    }
+    if (id >= current->lastCommand.size()) {
+        current->lastCommand.resize((size_t) id + 1, 0);
+    }
+    current->lastCommand[id] = current->sessions.now();
+    current->sessions.schedule(id, current->sessions.now() + sessionTimeout);
+}
+
+void World::expireSessions()
+{
+    WorldGeneration & generation = *current;
+    expired.clear();
+    generation.sessions.advance(generation.sessions.now() + 1, expired);
+    if (expired.empty()) {
+        return;
+    }
+
+    bool released = false;
+    for (uint32_t id : expired) {
+        uint64_t deadline = generation.lastCommand[id] + sessionTimeout;
+        if (deadline > generation.sessions.now()) {
+            generation.sessions.schedule(id, deadline);
+            continue;
+        }
+
+        generation.addrToTank.erase(generation.tanks.client[id]);
+        generation.tanks.unbind(id);
+        if (inbox != nullptr) {
+            departedClients.push_back(generation.tanks.client[id]);
+        }
+        stats.count(COUNTER_EXPIRED);
+        EventLog::log(LOG_INFO, SESSION_EXPIRED, (int32_t) id, (int32_t) sessionTimeout);
+        if (generation.tanks.isOnBoard(id)) {
+            generation.tanks.thread[id]->resetSocket();
+            generation.tanks.thread[id]->clearActions();
+            generation.freeTanks.push_back(id);
+            released = true;
+        }
+    }
+
+    if (released) {
+        std::vector<TankId> & clients = generation.active;
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [&generation](TankId id) {
+            return !generation.tanks.bound[id];
+        }), clients.end());
+    }
+}
+
+void World::markSubmitted(TankId id)
+{
+    if (!lockstep) {
+        return;
+    }
+    if (id >= submitted.size()) {
+        submitted.resize((size_t) id + 1, 0);
+    }
+    if (submitted[id] != lockstepWait) {
+        submitted[id] = lockstepWait;
+        if (submittedCount++ == 0) {
+            firstSubmission = RoundStats::Clock::now();
+        }
+    }
+}
+
+void World::waitForClients(RoundStats::Clock::time_point deadline)
+{
+    // Commands received before the wait were sent for the previous round, they are not counted
+    lockstepWait++;
+    submittedCount = 0;
+
+    RoundStats::Clock::time_point now = RoundStats::Clock::now();
+    while (now < deadline && (current->active.empty() || submittedCount < current->active.size())) {
+        if (pipeline != nullptr) {
+            // Packets are received by ingest thread, it wakes world up when it queues them
+            pipeline->waitForPacket(deadline);
+        } else {
+            long remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+            struct pollfd fd;
+            fd.fd = sd_listen;
+            fd.events = POLLIN;
+            struct timespec timeout = {remaining / 1000000, remaining % 1000000 * 1000};
+            if (ppoll(&fd, 1, &timeout, NULL) == -1 && errno != EINTR) {
+                syslog(LOG_ERR, "ppoll() failed: %s", strerror(errno));
+                throw runtime_error("ppoll() failed");
+            }
+        }
+        receiveMessages();
+        now = RoundStats::Clock::now();
+    }
+
+    if (submittedCount > 0) {
+        stats.recordPhase(PHASE_STRAGGLERS, now - firstSubmission);
+    }
+    if (now < deadline) {
+        stats.count(COUNTER_EARLY_COMMITS);
+    }
+}
+
 int World::printGameBoard()
 {
-    syslog(LOG_INFO, "printing roung");
+    if (inbox != nullptr && !attachSpectator()) {
+        return 0;
+    }
+    EventLog::log(LOG_INFO, BOARD_PRINTED, roundCount);
     // TODO: check for errors
     char comma = ',';
     char green = 'g';
     char red = 'r';
     char noTank = '0';
 
-    namedPipe << areaX << comma << areaY << comma;
+    namedPipe << boardHeader(areaX, areaY, boardHash);
 
     for (int i = 0; i < areaY; ++i) {
         for (int j = 0; j < areaX; ++j) {
-            if (mapToTank.find(i) != mapToTank.end() && mapToTank[i].find(j) != mapToTank[i].end()) {
-                if (mapToTank[i][j]->getTeam() == GREEN)
+            int32_t id = current->tanks.at(j, i);
+            if (id != -1) {
+                if (current->tanks.team[id] == GREEN)
                     namedPipe << green;
                 else
                     namedPipe << red;
@@ -237,256 +959,175 @@ int World::printGameBoard()
     }
 
     namedPipe.flush();
+    if (inbox != nullptr && !namedPipe) {
+        // Spectator left, SIGPIPE is ignored by host, so wait for the next one
+        namedPipe.close();
+        namedPipe.clear();
+    }
     return 0;
 }
 
-int World::performActions()
+bool World::attachSpectator()
 {
-    Tank::notifyAllTanks();
+    if (namedPipe.is_open()) {
+        return true;
+    }
+    int fd = open(pipePath.c_str(), O_WRONLY | O_NONBLOCK);
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    namedPipe.open(pipePath);
+    return namedPipe.is_open();
+}
 
-    // Handle FIRE action
-    for (auto rowIter = mapToTank.begin(); rowIter != mapToTank.end(); ++rowIter) {
-        for (auto colIter = rowIter->second.begin(); colIter != rowIter->second.end(); ++colIter) {
-            Tank *tank = colIter->second;
-
-            if (tank->waitForTank() == 0) {
-
-                switch (tank->getAction()) {
-
-                    case FIRE_UP: {
-                        auto iterUp = mapToTank.begin();
-                        while (iterUp != rowIter) {
-                            auto tankIterUp = iterUp->second.find(colIter->first);
-                            if (tankIterUp != iterUp->second.end()) {
-                                logTankHit(colIter->first, rowIter->first, colIter->first, iterUp->first);
-                                tankIterUp->second->markAsDestroyed();
-                            }
-                            iterUp++;
-                        }
-                        break;
-                    }
-
-                    case FIRE_DOWN: {
-                        auto iterDown = rowIter;
-                        while (++iterDown != mapToTank.end()) {
-                            auto tankIterDown = iterDown->second.find(colIter->first);
-                            if (tankIterDown != iterDown->second.end()) {
-                                logTankHit(colIter->first, rowIter->first, colIter->first, iterDown->first);
-                                tankIterDown->second->markAsDestroyed();
-                            }
-                        }
-                        break;
-                    }
-
-                    case FIRE_RIGHT: {
-                        auto iterRight = colIter;
-                        while (++iterRight != rowIter->second.end()) {
-                            logTankHit(colIter->first, rowIter->first, iterRight->first, rowIter->first);
-                            iterRight->second->markAsDestroyed();
-                        }
-                        break;
-                    }
-
-                    case FIRE_LEFT: {
-                        auto iterLeft = rowIter->second.begin();
-                        while (iterLeft != colIter) {
-                            logTankHit(colIter->first, rowIter->first, iterLeft->first, rowIter->first);
-                            iterLeft->second->markAsDestroyed();
-                            iterLeft++;
-                        }
-                        break;
-                    }
-
-                    default:
-                        break;
-                }
-            }
+int World::performActions()
+{
+    RoundStats::Clock::time_point start = RoundStats::Clock::now();
+    if (archive != nullptr && archive->needsKeyframe()) {
+        archive->writeKeyframe(roundCount - 1, getPlacement());
+    }
+    // Tanks without client have no action, their threads are not woken and the engine skips them
+    const std::vector<TankId> & active = replaying ? replayTanks : current->active;
+    if (!replaying) {
+        for (TankId id : active) {
+            current->tanks.thread[id]->notify(&current->tanks.action[id]);
         }
     }
 
-    // Handle MOVE action and remove destroyed tanks
-    auto rowIter = mapToTank.begin();
-    while (rowIter != mapToTank.end()) {
+    // Collect actions of active tanks in the order in which they act
+    EngineState state = current->tanks.state();
+    engine::order(state, active.data(), active.size(), scratch);
+    for (uint64_t key : scratch.order) {
+        TankId id = (TankId) key;
 
-        auto colIter = rowIter->second.begin();
-        while (colIter != rowIter->second.end()) {
-            Tank *tank = colIter->second;
+        if (replaying) {
+            current->tanks.action[id] = replayActions[id];
+        } else if (current->tanks.thread[id]->waitForTank() != 0) {
+            current->tanks.action[id] = UNDEFINED;
+            continue;
+        }
 
-            if (tank->isDestroyed()) {
-                rowIter->second.erase(colIter++);
-                continue;
+        if (current->tanks.action[id] != UNDEFINED && current->tanks.action[id] != NO_ACTION) {
+            stats.count(COUNTER_ACTIONS);
+            if (journal != nullptr && !restored) {
+                journalRound.actions.push_back(JournalAction{id, current->tanks.action[id]});
             }
-
-            switch (tank->getAction()) {
-
-                case MOVE_UP:
-                    // Am I at the end of map?
-                    if (rowIter->first == 0) {
-                        logTankRolledOffTheMap(colIter->first, rowIter->first);
-                        tank->markAsDestroyed();
-                    }
-                    else {
-                        // No tank above, Move up
-                        if (rowIter == mapToTank.begin()) {
-                            mapToTank[rowIter->first - 1].insert(pair<int, Tank *>(colIter->first, tank));
-                            rowIter->second.erase(colIter++);
-                            tank->_setActionToUndefined();
-                            continue;
-                        }
-
-                        auto closestUpRow = rowIter;
-                        closestUpRow--;
-                        auto closestUp = closestUpRow->second.find(colIter->first);
-
-                        // Tank crash
-                        if (rowIter->first - 1 == closestUpRow->first && closestUp != closestUpRow->second.end()) {
-                            logTankCrash(colIter->first, rowIter->first, colIter->first, closestUpRow->first);
-                            closestUp->second->markAsDestroyed();
-                            closestUpRow->second.erase(closestUp);
-                            tank->markAsDestroyed();
-                        }
-                        // Move up
-                        else {
-                            // Missing row
-                            if (rowIter->first - 1 != closestUpRow->first) {
-                                mapToTank[rowIter->first - 1].insert(pair<int, Tank *>(colIter->first, tank));
-                            }
-                            else {
-                                closestUpRow->second.insert(pair<int, Tank *>(colIter->first, tank));
-                            }
-                        }
-                    }
-                    rowIter->second.erase(colIter++);
-                    continue;
-
-
-                case MOVE_DOWN:
-                    // Am I at the end of map?
-                    if (rowIter->first + 1 >= areaY) {
-                        logTankRolledOffTheMap(colIter->first, rowIter->first);
-                        tank->markAsDestroyed();
-                    }
-                    else {
-                        auto closestDownRow = rowIter;
-                        closestDownRow++;
-
-                        // Create new row and Move Down
-                        if (closestDownRow == mapToTank.end() || rowIter->first + 1 != closestDownRow->first) {
-                            mapToTank[rowIter->first + 1].insert(pair<int, Tank *>(colIter->first, tank));
-                            tank->_setActionToUndefined();
-                        }
-                        // Row exist
-                        else {
-                            auto closestDown = closestDownRow->second.find(colIter->first);
-
-                            // Crash
-                            if (closestDown != closestDownRow->second.end()) {
-                                logTankCrash(colIter->first, rowIter->first, colIter->first, closestDownRow->first);
-                                closestDown->second->markAsDestroyed();
-                                closestDownRow->second.erase(closestDown);
-                                tank->markAsDestroyed();
-                            }
-                            // Move down
-                            else {
-                                closestDownRow->second.insert(pair<int, Tank *>(colIter->first, tank));
-                                tank->_setActionToUndefined();
-                            }
-                        }
-                    }
-                    rowIter->second.erase(colIter++);
-                    continue;
-
-
-                case MOVE_RIGHT:
-                    // Am I at the end of map?
-                    if (colIter->first + 1 >= areaX) {
-                        logTankRolledOffTheMap(colIter->first, rowIter->first);
-                        tank->markAsDestroyed();
-                    }
-                    else {
-                        auto closestRight = colIter;
-                        closestRight++;
-
-                        // Tank crash
-                        if (closestRight != rowIter->second.end() && colIter->first + 1 == closestRight->first) {
-                            logTankCrash(colIter->first, rowIter->first, closestRight->first, rowIter->first);
-                            closestRight->second->markAsDestroyed();
-                            rowIter->second.erase(closestRight);
-                            tank->markAsDestroyed();
-                        }
-                        // Move Right
-                        else {
-                            rowIter->second.insert(colIter, pair<int, Tank *>(colIter->first + 1, tank));
-                            tank->_setActionToUndefined();
-                        }
-
-                    }
-                    rowIter->second.erase(colIter++);
-                    continue;
-
-
-                case MOVE_LEFT:
-                    // Am I at the end of map?
-                    if (colIter->first == 0) {
-                        logTankRolledOffTheMap(colIter->first, rowIter->first);
-                        tank->markAsDestroyed();
-                    }
-                    else {
-                        auto closestLeft = colIter;
-
-                        // Tank crash
-                        if (colIter != rowIter->second.begin() && colIter->first - 1 == (--closestLeft)->first) {
-                            logTankCrash(colIter->first, rowIter->first, closestLeft->first, rowIter->first);
-                            closestLeft->second->markAsDestroyed();
-                            rowIter->second.erase(closestLeft);
-                            tank->markAsDestroyed();
-                        }
-                        // Move Left
-                        else {
-                            rowIter->second.insert(pair<int, Tank *>(colIter->first - 1, tank));
-                            tank->_setActionToUndefined();
-                        }
-                    }
-                    rowIter->second.erase(colIter++);
-                    continue;
-
-
-                default:
-                    break;
+            if (archive != nullptr) {
+                archive->addAction(id, current->tanks.action[id]);
             }
+        }
+    }
 
+    // Handle FIRE action
+    events.clear();
+    engine::fire(state, current->tanks.action.data(), scratch, &events);
+    logEvents();
+
+    if (journal != nullptr && !restored) {
+        journalRound.round = roundCount;
+        journal->writeRound(journalRound);
+        journalRound.actions.clear();
+    }
 
-            colIter++;
+    RoundStats::Clock::time_point fired = RoundStats::Clock::now();
+    stats.recordPhase(PHASE_FIRE, fired - start);
+    Trace::span("fire", "round", start, fired);
+
+    // Handle MOVE action and remove destroyed tanks, hit tanks are removed when the move phase reaches them
+    events.clear();
+    engine::orderHit(scratch);
+    engine::move(state, current->tanks.action.data(), scratch, &events);
+    logEvents();
+    engine::updateHash(state, scratch, boardHash);
+    EventLog::log(LOG_INFO, ROUND_HASHED, roundCount, (int32_t) (boardHash >> 32), (int32_t) boardHash);
+
+    // Threads of removed tanks finish after one more action
+    for (TankId id : scratch.removed) {
+        if (current->tanks.thread[id] != nullptr) {
+            current->tanks.thread[id]->markAsDestroyed()->notify();
         }
-
-        rowIter++;
+    }
+    if (!scratch.removed.empty()) {
+        std::vector<TankId> & clients = current->active;
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [this](TankId id) {
+            return !current->tanks.isOnBoard(id);
+        }), clients.end());
     }
 
+    RoundStats::Clock::time_point moved = RoundStats::Clock::now();
+    stats.recordPhase(PHASE_MOVE, moved - fired);
+    Trace::span("move", "round", fired, moved);
+
+    if (archive != nullptr) {
+        archive->finishRound();
+    }
     return 0;
 }
 
+void World::fillFrame(BoardFrame & frame) const
+{
+    frame.round = roundCount;
+    frame.hash = boardHash;
+    for (int y = 0; y < areaY; y++) {
+        for (int x = 0; x < areaX; x++) {
+            int32_t id = current->tanks.at(x, y);
+            frame.cells[(size_t) y * areaX + x] = id == -1 ? '0' : current->tanks.team[id] == GREEN ? 'g' : 'r';
+        }
+    }
+}
+
+void World::logEvents()
+{
+    for (const EngineEvent & event : events) {
+        switch (event.type) {
+            case TANK_HIT:
+                logTankHit(event.x, event.y, event.x2, event.y2);
+                break;
+            case TANK_CRASH:
+                logTankCrash(event.x, event.y, event.x2, event.y2);
+                break;
+            case TANK_ROLLED_OFF:
+                logTankRolledOffTheMap(event.x, event.y);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
 void World::logTankHit(int aggressorX, int aggressorY, int victimX, int victimY)
 {
-    syslog(LOG_INFO, "Aggresor at [%d,%d] destroy tank at [%d,%d].",
-           aggressorX, aggressorY, victimX, victimY);
+    stats.count(COUNTER_HITS);
+    EventLog::log(LOG_INFO, TANK_HIT, aggressorX, aggressorY, victimX, victimY);
+    if (archive != nullptr) {
+        archive->addEvent(TANK_HIT, aggressorX, aggressorY, victimX, victimY);
+    }
 }
 
 void World::logTankRolledOffTheMap(int x, int y)
 {
-    syslog(LOG_INFO, "Tank with at [%d,%d] rolled off the map.", x, y);
+    stats.count(COUNTER_ROLL_OFFS);
+    EventLog::log(LOG_INFO, TANK_ROLLED_OFF, x, y);
+    if (archive != nullptr) {
+        archive->addEvent(TANK_ROLLED_OFF, x, y);
+    }
 }
 
 void World::logTankCrash(int aggressorX, int aggressorY, int victimX, int victimY)
 {
-    syslog(LOG_INFO, "Tank at [%d,%d] crashed into tank at [%d,%d].",
-           aggressorX, aggressorY, victimX, victimY);
+    stats.count(COUNTER_CRASHES);
+    EventLog::log(LOG_INFO, TANK_CRASH, aggressorX, aggressorY, victimX, victimY);
+    if (archive != nullptr) {
+        archive->addEvent(TANK_CRASH, aggressorX, aggressorY, victimX, victimY);
+    }
 }
 
-void World::waitForAllTanks()
+void World::waitForAllTanks(WorldGeneration & generation)
 {
-    for (auto rowIter = mapToTank.begin(); rowIter != mapToTank.end(); ++rowIter) {
-        for (auto colIter = rowIter->second.begin(); colIter != rowIter->second.end(); ++colIter) {
-            colIter->second->waitForTank();
+    for (TankId id = 0; id < generation.tanks.size(); id++) {
+        if (generation.tanks.isOnBoard(id) && generation.tanks.thread[id] != nullptr) {
+            generation.tanks.thread[id]->waitForTank();
         }
     }
 }
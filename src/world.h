@@ -1,12 +1,26 @@
 #ifndef INTERNET_OF_TANKS_WORLD_H
 #define INTERNET_OF_TANKS_WORLD_H
 
+#include "archive.h"
+#include "journal.h"
+#include "pipeline.h"
+#include "ratelimit.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "tank.h"
+#include "tankstore.h"
+#include "timerwheel.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <set>
 #include <string>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -22,21 +36,71 @@ public:
     }
 };
 
+/**
+ * Tanks of one game with their threads and clients. The next game is built into its own generation,
+ * which is swapped with the current one between two rounds.
+ */
+struct WorldGeneration
+{
+    WorldGeneration(int areaX, int areaY)
+        : tanks(areaX, areaY)
+    {
+    }
+
+    TankStore tanks;                //<< state of tanks and gameboard
+
+    std::map<struct sockaddr_in, TankId, SockAddrComparator> addrToTank;
+
+    std::vector<TankId> freeTanks;  //<< tanks without client, assigned from the back
+
+    std::vector<TankId> active;     //<< tanks with client on gameboard, only they are notified in rounds
+
+    TimerWheel sessions;            //<< idle deadlines of bound clients indexed by tank id, ticks are rounds
+
+    std::vector<uint64_t> lastCommand;  //<< tick of the last command of client, indexed by tank id
+};
+
 class World
 {
+    friend class Benchmark;
+
 public:
     World(int areaX,
           int areaY,
           int redCount,
           int greenCount,
           std::string & namedPipe,
-          useconds_t roundTime);
+          useconds_t roundTime,
+          unsigned int seed);
 
-    virtual ~World()
-    {
-        close(sd_listen);
-        clearTanks();
-    }
+    /**
+     * Create arena hosted by ArenaHost. It has no socket of its own: the host passes packets of its
+     * clients into inbox and echoes are sent through the shared socket sd_shared. Rounds are paced
+     * by the host. Gameboard is printed into pipe only while the pipe has a reader.
+     */
+    World(int areaX,
+          int areaY,
+          int redCount,
+          int greenCount,
+          const std::string & namedPipe,
+          useconds_t roundTime,
+          unsigned int seed,
+          int sd_shared,
+          SpscQueue<ClientPacket> *inbox);
+
+    /**
+     * Create world for replaying journal. It has no socket and no pipe.
+     * @throw runtime_error when parameters are invalid
+     */
+    World(const JournalGame & game);
+
+    virtual ~World();
+
+    /**
+     * Open socket listening to tankclients
+     * @throw runtime_error if setting the socket fails
+     */
+    static int openListenSocket();
 
     /**
      * Initialization the game.
@@ -46,56 +110,325 @@ public:
      */
     void init();
 
+    /**
+     * Start building the next game in background. It replaces the current game between two rounds
+     * as soon as it is ready, tanks of the current game are torn down in background too.
+     */
+    void requestRestart();
+
     /**
      * Perform one round. Increase roundCount by one.
      * Get actions from tank threads, parse them and perform them. After that wait for roundTime micro seconds.
      */
     void performRound();
 
+    /**
+     * Get latency of round phases and counters of game events
+     */
+    const RoundStats & getStats() const;
+
+    /**
+     * Record seed, initial placement, actions of every round and final state of every game into journal
+     * @throw runtime_error when journal cannot be created
+     */
+    void recordJournal(const std::string & path);
+
+    /**
+     * Record keyframes, actions and events of every round into seekable archive
+     * @throw runtime_error when archive cannot be created
+     */
+    void recordArchive(const std::string & path, unsigned int keyframeInterval);
+
+    /**
+     * Write snapshot of the world every interval rounds and when the world is destroyed.
+     * Snapshots are written by background thread.
+     */
+    void recordSnapshots(const std::string & path, unsigned int interval);
+
+    /**
+     * Limit receiving of messages in one round, messages over the limit are received in the next round
+     * @param packets maximal number of packets, 0 means unlimited
+     * @param time maximal time in microseconds, 0 means unlimited
+     */
+    void limitIngestion(unsigned int packets, useconds_t time);
+
+    /**
+     * Ignore commands of clients sending faster than rate commands per second, bursts up to burst
+     * commands are allowed. Rate 0 means unlimited.
+     */
+    void limitClients(double rate, double burst);
+
+    /**
+     * Run rounds pipelined: packets are received by ingest thread during the round and gameboard
+     * is printed by publish thread during the next round, performRound only resolves the round.
+     * Commands are echoed after the round which received them.
+     * @throw runtime_error if the world has no socket or threads cannot be started
+     */
+    void startPipeline();
+
+    /**
+     * Finish round as soon as every client with tank on gameboard has sent a command after the previous
+     * round, round time is only the deadline of round
+     */
+    void setLockstep(bool lockstep);
+
+    /**
+     * Release tank of client which has sent no command for given number of rounds, the tank is given
+     * to the next new client. Client of destroyed tank is forgotten. 0 means that clients never expire.
+     */
+    void setSessionTimeout(unsigned int rounds);
+
+    /**
+     * Move addresses of clients forgotten by session expiry into clients, used by host of arena
+     * to forget the arena of the clients too. Addresses are collected only by hosted arena.
+     */
+    void takeDepartedClients(std::vector<struct sockaddr_in> & clients);
+
+    /**
+     * Count packet which host of arena dropped because the inbox was full, called between rounds
+     */
+    void countInboxOverflow();
+
+    /**
+     * Copy state of the world needed to continue the game after restart
+     */
+    WorldSnapshot snapshot() const;
+
+    /**
+     * Continue the game from snapshot instead of init. Tanks are bound to the same clients as before.
+     * Restored game is not recorded into journal, because the journal has no placement of it.
+     * @throw runtime_error when snapshot does not match parameters of the world or some error occurs
+     */
+    void restore(const WorldSnapshot & snapshot);
+
+    /**
+     * Initialize the game with tanks placed as in the journal
+     * @throw runtime_error when some error occurs
+     */
+    void initFromJournal(const JournalGame & game);
+
+    /**
+     * Initialize the game with given tanks as it was after given round
+     * @param threads start threads of tanks, otherwise they are started when clients take the tanks
+     * @throw runtime_error when some error occurs
+     */
+    void initFromPlacement(const std::vector<JournalTank> & placement, unsigned int round, bool threads = true);
+
+    /**
+     * Get tanks currently on gameboard with their positions, ordered by id
+     */
+    std::vector<JournalTank> getPlacement() const;
+
+    unsigned int getRoundCount() const
+    {
+        return roundCount;
+    }
+
+    /**
+     * Get zobrist hash of tanks on gameboard after the last round, see engine::hash
+     */
+    uint64_t getBoardHash() const
+    {
+        return boardHash;
+    }
+
+    /**
+     * Get number of tanks waiting for a client, used by host to place clients into arenas
+     */
+    size_t getFreeTankCount() const
+    {
+        return current->freeTanks.size();
+    }
+
+    /**
+     * Print gameboard of a world without pipe into given file, used to discard it into /dev/null
+     * @throw runtime_error when the file cannot be opened
+     */
+    void setBoardOutput(const std::string & path);
+
+    /**
+     * Perform one round with actions from the journal instead of actions from tankclients.
+     * Nothing is received and there is no waiting for the end of round. Gameboard is printed
+     * only if board output is set.
+     */
+    void replayRound(const JournalRound & round);
+
+    /**
+     * Compare current state with the final state from the journal
+     * @return true if the states are the same
+     */
+    bool verifyJournalEnd(const JournalEnd & end) const;
+
 private:
     int areaX;
     int areaY;
     int redCount;
     int greenCount;
     std::ofstream namedPipe;    //<< pipe to worldclient
+    std::string pipePath;       //<< pipe of hosted arena, opened when it has a reader
     useconds_t roundTime;
     unsigned int roundCount;
+    unsigned int seed;
+    std::mt19937 random;        //<< placement of tanks, own generator keeps arenas independent of each other
 
     int sd_listen;             //<< listening socket descriptor
+    SpscQueue<ClientPacket> *inbox; //<< packets passed by host of arena, sd_listen is owned by host then
+    unsigned int ingestPackets;     //<< packets received in one round at most, 0 is unlimited
+    useconds_t ingestTime;          //<< time of receiving in one round at most, 0 is unlimited
+    TokenBuckets clientBuckets;     //<< rate limits of clients indexed by tank id
+    std::unique_ptr<RoundPipeline> pipeline;    //<< receives and prints if rounds are pipelined
+    BoardFrame *frame;              //<< frame of the current round if rounds are pipelined
+    bool lockstep;                  //<< round finishes when all clients submitted
+    unsigned int lockstepWait;      //<< number of the current wait for clients
+    std::vector<unsigned int> submitted;    //<< wait in which tank received command, indexed by tank id
+    size_t submittedCount;          //<< tanks which received command in the current wait
+    RoundStats::Clock::time_point firstSubmission;  //<< of the current wait
+    unsigned int sessionTimeout;    //<< idle rounds after which client loses its tank, 0 is never
+    std::vector<uint32_t> expired;  //<< sessions expired in the current round
+    std::vector<struct sockaddr_in> departedClients;    //<< expired clients of hosted arena, taken by host
+
+    std::unique_ptr<WorldGeneration> current;   //<< tanks of the current game
 
-    std::vector<Tank*> tanks;
+    std::thread restartThread;      //<< builds the next game or tears down the previous one
+    std::atomic_bool restartBusy;   //<< restartThread is running
+    bool restartRequested;          //<< build the next game when restartThread is free
+    std::unique_ptr<WorldGeneration> nextGeneration;    //<< built next game, swapped in by performRound
+    std::unique_ptr<WorldGeneration> oldGeneration;     //<< previous game torn down by restartThread
+    std::mutex restartMutex;
+    std::condition_variable restartSlice;   //<< signalled when a slice is granted or restart is cancelled
+    bool restartGranted;            //<< restartThread may perform the next slice
+    bool restartUnpaced;            //<< restartThread finishes without waiting for slices
 
-    std::map<int, std::map<int, Tank*> > mapToTank;   // row, column
+    EngineScratch scratch;          //<< order of tanks in the current round
+    std::vector<EngineEvent> events;    //<< events of the current phase
 
-    std::map<struct sockaddr_in, Tank*, SockAddrComparator> addrToTank;
+    RoundStats stats;
 
-    std::vector<Tank*> freeTanks;
+    JournalWriter *journal;         //<< records the game if it is set
+    JournalRound journalRound;      //<< actions of the current round
+    ArchiveWriter *archive;         //<< records the game if it is set
+    bool replaying;                 //<< actions are taken from replayActions instead of tanks
+    std::vector<Action> replayActions;  //<< indexed by tank id
+    std::vector<TankId> replayTanks;    //<< tanks with action in replayActions
+    SnapshotWriter *snapshotWriter;     //<< writes snapshots if it is set
+    unsigned int snapshotInterval;
+    bool restored;                  //<< current game was restored from snapshot
+    uint64_t boardHash;             //<< zobrist hash of gameboard, updated by changes of every round
 
 
     /**
      * Create tank - generate random position for tank, create new thread
-     * and add new Tank pointer into maps maintaining tanks.
-     * @return pointer to created tank
+     * and add the tank into tank store of generation.
+     * @return id of created tank
      * @throw runtime_error if creating tank fail
      */
-    Tank * createTank(Team team);
+    TankId createTank(WorldGeneration & generation, Team team);
+
+    /**
+     * Create tank on given position
+     * @param threaded start thread of the tank, otherwise it is started by bindClient
+     * @throw runtime_error if creating tank fail
+     */
+    TankId createTankAt(WorldGeneration & generation, Team team, TankId id, int x, int y, bool threaded = true);
+
+    /**
+     * Start thread of tank of the current game which was created without it
+     * @throw runtime_error if creating thread fail
+     */
+    void startTankThread(TankId id);
 
     /**
      * Create several tanks using createTank method.
+     * @param paced wait for a restart slice after every RESTART_SLICE tanks
      * @throw runtime_error if creating tank fail
      */
-    void createTanks(Team team, int count);
+    void createTanks(WorldGeneration & generation, Team team, int count, bool paced = false);
 
     /**
-     * Prepare for listening to connection from tankclients
-     * @throw runtime_error if setting the socket fails
+     * Create tanks of a new game on random positions and wait until their threads are ready
+     * @param paced tanks are created in restart slices, used by restartThread
+     * @throw runtime_error if creating tank fail, created tanks are torn down
+     */
+    std::unique_ptr<WorldGeneration> buildGeneration(bool paced = false);
+
+    /**
+     * Make generation current, the previous one is returned in generation. Journal and archive
+     * are finished for the previous game and started for the new one.
+     */
+    void startGeneration(std::unique_ptr<WorldGeneration> & generation);
+
+    /**
+     * Stop threads of tanks of generation and free them
+     * @param paced tanks are stopped in restart slices, used by restartThread
+     */
+    void teardownGeneration(WorldGeneration & generation, bool paced = false);
+
+    /**
+     * Let restartThread perform one more slice, called after tick of every round
+     */
+    void grantRestartSlice();
+
+    /**
+     * Block restartThread until the round thread grants a slice or restart is cancelled
      */
-    void setListenSocket();
+    void waitForRestartSlice();
 
+    /**
+     * Swap prepared next game in or start its preparation, never waits for restartThread
+     */
+    void advanceRestart();
+
+    /**
+     * Wait for restartThread and drop the prepared next game
+     */
+    void cancelRestart();
+
+    /**
+     * Receive messages from socket or from pipeline within ingestion budget
+     */
     void receiveMessages();
 
     /**
-     * Iterate through all tanks ale perform theirs actions
+     * Check if a packet waits in socket, pipeline or inbox, the packet is not taken
+     */
+    bool hasPendingPacket() const;
+
+    /**
+     * Bind client to a free tank or pass the command to its tank
+     * @return true if the command is accepted and has to be echoed
+     */
+    bool handlePacket(const ClientPacket & packet, RoundStats::Clock::time_point now);
+
+    /**
+     * Bind client to tank and start its session, thread of the tank is started if it has none
+     * @throw runtime_error if socket or thread of the tank cannot be set
+     */
+    void bindClient(TankId id, const struct sockaddr_in & addr);
+
+    /**
+     * Start idle timeout of client of tank
+     */
+    void startSession(TankId id);
+
+    /**
+     * Advance sessions by one round and release tanks of clients which have been idle for sessionTimeout rounds.
+     * Deadline of a session is moved only when its timer expires, so commands cost no timer operation.
+     */
+    void expireSessions();
+
+    /**
+     * Remember that client of tank has submitted its command in the current wait
+     */
+    void markSubmitted(TankId id);
+
+    /**
+     * Receive messages until every client submitted its command or until deadline
+     */
+    void waitForClients(RoundStats::Clock::time_point deadline);
+
+    /**
+     * Perform actions of active tanks, tanks without action are visited only when they are hit
+     * or crashed into
      */
     int performActions();
 
@@ -105,28 +438,49 @@ private:
     int printGameBoard();
 
     /**
-     * Empty map maintaining tanks and free memory occupied by this tank.
+     * Open pipe of hosted arena if somebody reads it, writing into pipe without reader would block
+     * @return true if the pipe is open
+     */
+    bool attachSpectator();
+
+    /**
+     * Copy game state into frame printed by publish thread
+     */
+    void fillFrame(BoardFrame & frame) const;
+
+    /**
+     * Empty tank store and free threads of its tanks.
      * Destructor of this tanks should terminate their threads.
      */
     void clearTanks();
 
     /**
-     * Wait for ready semaphore on all tanks. After this, all tanks are ready to receive notify_all.
+     * Write final state of the current game into journal
+     */
+    void journalGameEnd();
+
+    /**
+     * Wait for ready semaphore on all tanks of generation. After this, all tanks are ready to be notified.
+     */
+    static void waitForAllTanks(WorldGeneration & generation);
+
+    /**
+     * Log events of the current phase by the functions below
      */
-    void waitForAllTanks();
+    void logEvents();
 
     /**
-     * Log 'Tank hit' event into syslog
+     * Log 'Tank hit' event into EventLog
      */
     void logTankHit(int aggressorX, int aggressorY, int victimX, int victimY);
 
     /**
-     * Log 'Tank rolled off the map' event into syslog
+     * Log 'Tank rolled off the map' event into EventLog
      */
     void logTankRolledOffTheMap(int x, int y);
 
     /**
-     * * Log 'Tank crash' event into syslog
+     * Log 'Tank crash' event into EventLog
      */
     void logTankCrash(int aggressorX, int aggressorY, int victimX, int victimY);
 };
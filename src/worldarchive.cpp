@@ -0,0 +1,220 @@
+#include "archive.h"
+#include "eventlog.h"
+#include "world.h"
+
+#include <getopt.h>
+#include <libintl.h>
+#include <locale.h>
+#include <sys/syslog.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#define _(STRING) gettext(STRING)
+
+using namespace std;
+
+const struct option LONG_ARGS[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"list", no_argument, NULL, 'l'},
+        {"game", required_argument, NULL, 'g'},
+        {"round", required_argument, NULL, 'r'},
+        {"extract", no_argument, NULL, 'e'},
+        {0, 0, 0, 0}
+};
+
+void printHelp()
+{
+    cout << _("Usage:") << " worldarchive [" << _("options") << "] <archive>" << endl;
+    cout << "\t" << "-l, --list" << endl;
+    cout << "\t\t" << _("list keyframes of the archive") << endl;
+    cout << "\t" << "-g, --game <N>" << endl;
+    cout << "\t\t" << _("use game <N> of the archive (default 0)") << endl;
+    cout << "\t" << "-r, --round <N>" << endl;
+    cout << "\t\t" << _("render gameboard after round <N>") << endl;
+    cout << "\t" << "-e, --extract" << endl;
+    cout << "\t\t" << _("print tanks as id,x,y,team lines instead of rendering the gameboard") << endl;
+    cout << "\t" << "-h, --help" << endl;
+    cout << "\t\t" << _("print this help") << endl << endl;
+}
+
+void listKeyframes(const ArchiveReader & reader)
+{
+    const ArchiveHeader & header = reader.getHeader();
+    cout << _("area") << ": " << header.areaX << "x" << header.areaY
+         << ", " << _("keyframe interval") << ": " << header.keyframeInterval << endl;
+
+    for (uint32_t i = 0; i < reader.keyframeCount(); i++) {
+        ArchiveSegment segment = reader.segment(i);
+        cout << _("game") << " " << segment.header->game
+             << " " << _("round") << " " << segment.header->round
+             << ": " << segment.header->tankCount << " " << _("tanks")
+             << ", " << segment.header->roundCount << " " << _("rounds")
+             << ", " << segment.header->actionCount << " " << _("actions")
+             << ", " << segment.header->eventCount << " " << _("events") << endl;
+    }
+}
+
+/**
+ * Simulate rounds from the nearest keyframe up to the round
+ * @return placement of tanks after the round
+ */
+vector<JournalTank> seekRound(const ArchiveReader & reader, const ArchiveSegment & segment, uint32_t round)
+{
+    const ArchiveHeader & header = reader.getHeader();
+    JournalGame game = {header.areaX, header.areaY, header.redCount, header.greenCount, 0, {}};
+
+    World world(game);
+    world.initFromPlacement(segment.keyframe(), segment.header->round);
+
+    uint32_t action = 0;
+    JournalRound journalRound;
+    for (uint32_t i = 0; segment.header->round + i < round; i++) {
+        journalRound.round = segment.header->round + i + 1;
+        journalRound.actions.clear();
+        for (uint32_t end = action + segment.roundActions[i]; action < end; action++) {
+            journalRound.actions.push_back(JournalAction{segment.actionTankIds[action], segment.actions[action]});
+        }
+        world.replayRound(journalRound);
+    }
+    return world.getPlacement();
+}
+
+void printEvents(const ArchiveSegment & segment, uint32_t round)
+{
+    if (round == segment.header->round) {
+        return;
+    }
+
+    uint32_t event = 0;
+    uint32_t i = 0;
+    for (; segment.header->round + i + 1 < round; i++) {
+        event += segment.roundEvents[i];
+    }
+    for (uint32_t end = event + segment.roundEvents[i]; event < end; event++) {
+        switch (segment.eventTypes[event]) {
+            case TANK_HIT:
+                cout << _("tank") << " [" << segment.eventX[event] << "," << segment.eventY[event] << "] "
+                     << _("hit tank") << " [" << segment.eventX2[event] << "," << segment.eventY2[event] << "]" << endl;
+                break;
+            case TANK_CRASH:
+                cout << _("tank") << " [" << segment.eventX[event] << "," << segment.eventY[event] << "] "
+                     << _("crashed into tank") << " [" << segment.eventX2[event] << "," << segment.eventY2[event] << "]"
+                     << endl;
+                break;
+            case TANK_ROLLED_OFF:
+                cout << _("tank") << " [" << segment.eventX[event] << "," << segment.eventY[event] << "] "
+                     << _("rolled off the map") << endl;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void renderGameboard(const ArchiveHeader & header, const vector<JournalTank> & tanks)
+{
+    vector<char> board((size_t) header.areaX * header.areaY, '.');
+    for (const JournalTank & tank : tanks) {
+        board[(size_t) tank.y * header.areaX + tank.x] = tank.team == GREEN ? 'G' : 'R';
+    }
+    for (int y = 0; y < header.areaY; y++) {
+        cout.write(&board[(size_t) y * header.areaX], header.areaX);
+        cout << '\n';
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    setlocale(LC_ALL, "");
+    bindtextdomain("worldarchive", "../locale");
+    textdomain("worldarchive");
+
+    //handle main arguments
+    bool list = false;
+    bool extract = false;
+    bool roundSet = false;
+    uint32_t game = 0;
+    uint32_t round = 0;
+    char opt;
+    while ((opt = (char) getopt_long(argc, argv, "lg:r:eh", LONG_ARGS, NULL)) != -1) {
+        switch (opt)
+        {
+            case 'l': //list
+                list = true;
+                break;
+            case 'g': //game
+                game = (uint32_t) strtoul(optarg, NULL, 10);
+                break;
+            case 'r': //round
+                round = (uint32_t) strtoul(optarg, NULL, 10);
+                roundSet = true;
+                break;
+            case 'e': //extract
+                extract = true;
+                break;
+            case 'h': //help
+                printHelp();
+                exit(0);
+            default:
+                printHelp();
+                exit(1);
+        }
+    }
+    if (optind != argc - 1 || (!list && !roundSet)) {
+        printHelp();
+        return -1;
+    }
+
+    try {
+        ArchiveReader reader(argv[optind]);
+        if (list) {
+            listKeyframes(reader);
+            return 0;
+        }
+
+        long keyframe = reader.findKeyframe(game, round);
+        if (keyframe == -1) {
+            cout << _("round is not in the archive") << endl;
+            return -1;
+        }
+        ArchiveSegment segment = reader.segment((uint32_t) keyframe);
+        if (round > segment.header->round + segment.header->roundCount) {
+            cout << _("round is not in the archive") << endl;
+            return -1;
+        }
+
+        auto start = chrono::steady_clock::now();
+        vector<JournalTank> tanks = seekRound(reader, segment, round);
+        double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (extract) {
+            for (const JournalTank & tank : tanks) {
+                cout << tank.id << "," << tank.x << "," << tank.y << "," << (tank.team == GREEN ? "green" : "red")
+                     << endl;
+            }
+            return 0;
+        }
+
+        cout << _("game") << " " << game << ", " << _("round") << " " << round << ", "
+             << tanks.size() << " " << _("tanks") << " (" << round - segment.header->round << " "
+             << _("rounds simulated from keyframe in") << " " << milliseconds << " ms)" << endl;
+        renderGameboard(reader.getHeader(), tanks);
+
+        // Events of the keyframe round are stored in the previous segment
+        if (round == segment.header->round && keyframe > 0 && reader.keyframe((uint32_t) keyframe - 1).game == game) {
+            printEvents(reader.segment((uint32_t) keyframe - 1), round);
+        } else {
+            printEvents(segment, round);
+        }
+
+    } catch (std::runtime_error &err){
+        syslog(LOG_ERR, "caught exception: %s", err.what());
+        cout << err.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
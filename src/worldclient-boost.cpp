@@ -0,0 +1,85 @@
+#include "worldclient.h"
+
+#include <getopt.h>
+#include <libintl.h>
+#include <locale.h>
+#include <sys/syslog.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#define _(STRING) gettext(STRING)
+
+using namespace std;
+
+const struct option LONG_ARGS[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"pipe", required_argument, NULL, 'p'},
+        {"max-fps", required_argument, NULL, 'f'},
+        {0, 0, 0, 0}
+};
+
+void printHelp()
+{
+    cout << _("Usage:") << endl;
+    cout << "\t" << "-p, --pipe <path>" << endl;
+    cout << "\t\t" << _("path to a named pipe of world program") << endl;
+    cout << "\t" << "-f, --max-fps <N>" << endl;
+    cout << "\t\t" << _("render at most <N> frames per second, older frames are skipped") << endl;
+    cout << "\t" << "-h, --help" << endl;
+    cout << "\t\t" << _("print this help") << endl << endl;
+
+    cout << "\t" << _("Controls:") << endl;
+    cout << "\t\t" << _("Use arrows or 'h' 'j' 'k' 'l' for scrolling.") << endl;
+    cout << "\t\t" << _("Use '-' and '+' for zooming out and in.") << endl;
+    cout << "\t\t" << _("Use 'r' for restart, 'x' for stopping world and 'q' for exit.") << endl;
+}
+
+int main(int argc, char ** argv)
+{
+    setlocale(LC_ALL, "");
+    bindtextdomain("worldclient", "../locale");
+    textdomain("worldclient");
+
+    //handle main arguments
+    char * pipe = nullptr;
+    unsigned int maxFps = 0;
+    char opt;
+    while ((opt = (char) getopt_long(argc, argv, "p:f:h", LONG_ARGS, NULL)) != -1) {
+        switch (opt)
+        {
+            case 'p': //pipe
+                pipe = optarg;
+                break;
+            case 'f': //max-fps
+                maxFps = (unsigned int) atoi(optarg);
+                break;
+            case 'h': //pipe
+                printHelp();
+                exit(0);
+            default:
+                printHelp();
+                exit(1);
+        }
+    }
+    if (pipe == nullptr) {
+        std::cout << _("-p option required.") << std::endl;
+        syslog(LOG_ERR, "Argument pipe is required. Exitting");
+        return -1;
+    }
+
+    try {
+        WorldClient wc (pipe, maxFps);
+
+        if (wc.run() != 0) {
+            return -1;
+        }
+
+    } catch (std::runtime_error &err){
+        syslog(LOG_ERR, "caught exception: %s", err.what());
+        return -1;
+    }
+
+    return 0;
+}
@@ -1,15 +1,17 @@
 #include "worldclient.h"
 
 #include <fcntl.h>
-#include <getopt.h>
 #include <libintl.h>
-#include <locale.h>
+#include <poll.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/syslog.h>
 #include <unistd.h>
 
+#include <cctype>
+#include <cstdlib>
 #include <iostream>
 #include <stdexcept>
 
@@ -17,25 +19,36 @@
 
 using namespace std;
 
-const struct option LONG_ARGS[] = {
-        {"help", no_argument, NULL, 'h'},
-        {"pipe", required_argument, NULL, 'p'},
-        {0, 0, 0, 0}
-};
-
-void printHelp()
+WorldClient::WorldClient(): y(0),
+                            x(0),
+                            pipe(-1),
+                            zoom(0),
+                            viewX(0),
+                            viewY(0),
+                            viewWidth(0),
+                            viewHeight(0),
+                            minFrameInterval(0),
+                            renderedFrames(0),
+                            droppedFrames(0),
+                            lastLatency(0),
+                            lastHash(0)
 {
-    cout << _("Usage:") << endl;
-    cout << "\t" << "-p, --pipe <path>" << endl;
-    cout << "\t\t" << _("path to a named pipe of world program") << endl;
-    cout << "\t" << "-h, --help" << endl;
-    cout << "\t\t" << _("print this help") << endl;
 }
 
-WorldClient::WorldClient(char *path): y(0),
+WorldClient::WorldClient(char *path, unsigned int maxFps): y(0),
                                       x(0),
                                       pipe(0),
-                                      pipeName(path)
+                                      pipeName(path),
+                                      zoom(0),
+                                      viewX(0),
+                                      viewY(0),
+                                      viewWidth(0),
+                                      viewHeight(0),
+                                      minFrameInterval(maxFps ? 1000000 / maxFps : 0),
+                                      renderedFrames(0),
+                                      droppedFrames(0),
+                                      lastLatency(0),
+                                      lastHash(0)
 {
 
     //if pipe doesn't exist, create it
@@ -53,6 +66,7 @@ WorldClient::WorldClient(char *path): y(0),
     noecho();
     curs_set(0);
     nodelay(stdscr, true);
+    keypad(stdscr, true);
 
     //prepare color pairs
     init_pair(1, COLOR_WHITE, COLOR_BLACK);
@@ -61,74 +75,196 @@ WorldClient::WorldClient(char *path): y(0),
     attron(COLOR_PAIR(1));
 
     // open pipe to world
-    pipe = open(path, O_RDONLY);
+    if (openPipe() != 0) {
+        endwin();
+        throw std::runtime_error("opening pipe failed");
+    }
 }
 
-int WorldClient::readGameBoardSize() {
-    char cur;
-    char buffer[16];
-    memset(buffer, 0, 16);
-    int counter = 0;
-    while (1){
-        ssize_t ret_val;
-        if ((ret_val = read(pipe, &cur, 1)) == -1) {
-            syslog(LOG_ERR, "read failed: %s", strerror(errno));
-            return -1;
+int WorldClient::openPipe()
+{
+    if (pipe > 0) {
+        close(pipe);
+    }
+    // Non-blocking open does not wait for world and poll() does not report hang up
+    // until some world opens the pipe for writing
+    if ((pipe = open(pipeName.c_str(), O_RDONLY | O_NONBLOCK)) == -1) {
+        syslog(LOG_ERR, "open() of pipe %s failed: %s", pipeName.c_str(), strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int WorldClient::fillPipeBuffer()
+{
+    size_t oldSize = pipeBuffer.size();
+    int ret_val = 0;
+
+    // Drain everything the world has written so far
+    while (true) {
+        int available = 0;
+        if (ioctl(pipe, FIONREAD, &available) == -1 || available <= 0) {
+            available = 4096;
         }
-        if (ret_val == 0){
-            usleep(500000);
-            return -2;
+
+        size_t size = pipeBuffer.size();
+        pipeBuffer.resize(size + available);
+        ssize_t count = read(pipe, &pipeBuffer[size], available);
+        pipeBuffer.resize(size + (count > 0 ? count : 0));
+
+        if (count > 0) {
+            continue;
         }
-        if (cur == ','){
+        if (count == 0) {
+            // World closed the pipe, wait for the next one
+            ret_val = openPipe() == 0 ? -2 : -1;
             break;
         }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            syslog(LOG_ERR, "read failed: %s", strerror(errno));
+            ret_val = -1;
+        }
+        break;
+    }
 
-        buffer[counter] = cur;
-        counter++;
+    if (pipeBuffer.size() != oldSize) {
+        arrivals.push_back(std::make_pair(pipeBuffer.size(), Clock::now()));
     }
-    x = atoi(buffer);
+    return ret_val;
+}
 
-    memset(buffer, 0, 16);
-    counter = 0;
-    while (1){
-        if (read(pipe, &cur, 1) == -1) {
-            syslog(LOG_ERR, "wtf");
+int WorldClient::parseFrameHeader(size_t offset, int & frameX, int & frameY, uint64_t & hash, size_t & body) const
+{
+    int size[2];
+    size_t pos = offset;
+
+    for (int i = 0; i < 2; i++) {
+        int digits = 0;
+        size[i] = 0;
+        while (pos < pipeBuffer.size() && isdigit(pipeBuffer[pos])) {
+            if (++digits > 9) {
+                return -1;
+            }
+            size[i] = size[i] * 10 + (pipeBuffer[pos++] - '0');
+        }
+        if (pos == pipeBuffer.size()) {
+            return 1;
+        }
+        if (digits == 0 || pipeBuffer[pos] != ',') {
+            return -1;
+        }
+        pos++;
+    }
+
+    int digits = 0;
+    hash = 0;
+    while (pos < pipeBuffer.size() && isxdigit(pipeBuffer[pos])) {
+        if (++digits > 16) {
+            return -1;
+        }
+        char digit = (char) tolower(pipeBuffer[pos++]);
+        hash = hash << 4 | (uint64_t) (isdigit(digit) ? digit - '0' : digit - 'a' + 10);
+    }
+    if (pos == pipeBuffer.size()) {
+        return 1;
+    }
+    if (digits == 0 || pipeBuffer[pos] != ',') {
+        return -1;
+    }
+    pos++;
+
+    frameX = size[0];
+    frameY = size[1];
+    body = pos;
+    return (pipeBuffer.size() - body) / 2 >= (size_t) frameX * frameY ? 0 : 1;
+}
+
+int WorldClient::findNewestFrame(size_t & frameStart, int & frameX, int & frameY, uint64_t & hash, size_t & body)
+{
+    int ret_val = 1;
+    size_t offset = 0;
+    unsigned long skipped = 0;
+
+    // Only headers are decoded, fields of obsolete frames are jumped over
+    while (true) {
+        int curX, curY;
+        uint64_t curHash;
+        size_t curBody;
+        int found = parseFrameHeader(offset, curX, curY, curHash, curBody);
+        if (found == -1) {
             return -1;
         }
-        if (cur == ','){
+        if (found == 1) {
             break;
         }
+        if (ret_val == 0) {
+            skipped++;
+        }
+        frameStart = offset;
+        frameX = curX;
+        frameY = curY;
+        hash = curHash;
+        body = curBody;
+        offset = curBody + 2 * (size_t) curX * curY;
+        ret_val = 0;
+    }
 
-        buffer[counter] = cur;
-        counter++;
+    if (ret_val == 0) {
+        droppedFrames += skipped;
+        consumePipeBuffer(frameStart);
+        body -= frameStart;
+        frameStart = 0;
     }
-    y = atoi(buffer);
-    return 0;
+    return ret_val;
 }
 
-int WorldClient::printGameboardFrame()
+void WorldClient::consumePipeBuffer(size_t count)
 {
+    if (count == 0) {
+        return;
+    }
+    pipeBuffer.erase(0, count);
 
-    int oldX = x;
-    int oldY = y;
-    //load size of gameboard
-    int ret_val = readGameBoardSize();
-    if (ret_val != 0){
-        return ret_val;
+    auto iter = arrivals.begin();
+    while (iter != arrivals.end() && iter->first <= count) {
+        iter++;
     }
+    arrivals.erase(arrivals.begin(), iter);
+    for (auto & arrival : arrivals) {
+        arrival.first -= count;
+    }
+}
 
-    // If gameboard size didn't change do nothing
-    if(oldX == x && oldY == y){
+WorldClient::Clock::time_point WorldClient::arrivalOf(size_t offset) const
+{
+    for (auto & arrival : arrivals) {
+        if (arrival.first > offset) {
+            return arrival.second;
+        }
+    }
+    return Clock::now();
+}
+
+int WorldClient::printGameboardFrame(int width, int height)
+{
+    // If viewport size didn't change do nothing
+    if(width == viewWidth && height == viewHeight){
         return 0;
     }
+    viewWidth = width;
+    viewHeight = height;
 
     clear();
     attron(COLOR_PAIR(1));
+    screenCells.assign((size_t) viewWidth * viewHeight, 0);
 
     //print game frame
-    for (int curY = 0; curY <= y+1; curY++) {
-        for (int curX  = 0; curX <= x+1; curX++) {
-            if (curX == 0 || curX == x+1 || curY == 0 || curY == y+1) {
+    for (int curY = 0; curY <= viewHeight+1; curY++) {
+        for (int curX  = 0; curX <= viewWidth+1; curX++) {
+            if (curX == 0 || curX == viewWidth+1 || curY == 0 || curY == viewHeight+1) {
                 mvaddch(curY, curX, '$');
             }
         }
@@ -136,6 +272,219 @@ int WorldClient::printGameboardFrame()
     return 0;
 }
 
+uint8_t WorldClient::decodeField(const char *field)
+{
+    if (field[1] != ',') {
+        syslog(LOG_ERR, "illegal field separator from pipe");
+    }
+
+    switch (field[0])
+    {
+        case '0':
+            return EMPTY_FIELD;
+        case 'g':
+            return GREEN_FIELD;
+        case 'r':
+            return RED_FIELD;
+        default:
+            syslog(LOG_ERR, "illegal field input: %c", field[0]);
+            return EMPTY_FIELD;
+    }
+}
+
+const WorldClient::BlockCount *WorldClient::reducedBoard(int level)
+{
+    // Every level is reduced from the previous one at most once per frame,
+    // so browsing all levels costs at most a third of the board area
+    while ((int) levels.size() < level) {
+        int k = (int) levels.size() + 1;
+        int width = levelWidth(k);
+        int height = levelHeight(k);
+        int prevWidth = levelWidth(k - 1);
+        int prevHeight = levelHeight(k - 1);
+        std::vector<BlockCount> blocks((size_t) width * height);
+
+        if (k == 1) {
+            for (int curY = 0; curY < prevHeight; curY++) {
+                const uint8_t *fields = &board[(size_t) curY * prevWidth];
+                BlockCount *row = &blocks[(size_t) (curY >> 1) * width];
+                for (int curX = 0; curX < prevWidth; curX++) {
+                    row[curX >> 1].green += fields[curX] == GREEN_FIELD;
+                    row[curX >> 1].red += fields[curX] == RED_FIELD;
+                }
+            }
+        } else {
+            const std::vector<BlockCount> & prev = levels.back();
+            for (int curY = 0; curY < prevHeight; curY++) {
+                const BlockCount *prevRow = &prev[(size_t) curY * prevWidth];
+                BlockCount *row = &blocks[(size_t) (curY >> 1) * width];
+                for (int curX = 0; curX < prevWidth; curX++) {
+                    row[curX >> 1].green += prevRow[curX].green;
+                    row[curX >> 1].red += prevRow[curX].red;
+                }
+            }
+        }
+        levels.push_back(std::move(blocks));
+    }
+    return levels[level - 1].data();
+}
+
+int WorldClient::levelWidth(int level) const
+{
+    return (x + (1 << level) - 1) >> level;
+}
+
+int WorldClient::levelHeight(int level) const
+{
+    return (y + (1 << level) - 1) >> level;
+}
+
+int WorldClient::maxZoom() const
+{
+    int level = 0;
+    while ((x >> level) > 1 || (y >> level) > 1) {
+        level++;
+    }
+    return level;
+}
+
+chtype WorldClient::fieldGlyph(uint8_t field)
+{
+    switch (field)
+    {
+        case GREEN_FIELD:
+            return 'X' | COLOR_PAIR(2);
+        case RED_FIELD:
+            return 'X' | COLOR_PAIR(3);
+        default:
+            return ' ' | COLOR_PAIR(1);
+    }
+}
+
+chtype WorldClient::blockGlyph(const BlockCount & block, int level)
+{
+    static const char density[] = ".:-=+*#%@";
+    const unsigned int steps = sizeof density - 1;
+
+    unsigned int tanks = block.green + block.red;
+    if (tanks == 0) {
+        return ' ' | COLOR_PAIR(1);
+    }
+
+    unsigned long area = 1UL << (2 * level);
+    unsigned int step = (unsigned int) ((tanks * (unsigned long) steps - 1) / area);
+    chtype glyph = density[step < steps ? step : steps - 1];
+
+    if (block.green > block.red) {
+        return glyph | COLOR_PAIR(2);
+    }
+    if (block.red > block.green) {
+        return glyph | COLOR_PAIR(3);
+    }
+    return glyph | COLOR_PAIR(1);
+}
+
+void WorldClient::printViewport()
+{
+    if (board.empty()) {
+        return;
+    }
+
+    if (zoom > maxZoom()) {
+        zoom = maxZoom();
+    }
+    int width = levelWidth(zoom);
+    int height = levelHeight(zoom);
+
+    // Leave space for the frame and statistics line
+    int screenWidth = COLS - 2 > 1 ? COLS - 2 : 1;
+    int screenHeight = LINES - 3 > 1 ? LINES - 3 : 1;
+    printGameboardFrame(width < screenWidth ? width : screenWidth,
+                        height < screenHeight ? height : screenHeight);
+
+    if (viewX > width - viewWidth) {
+        viewX = width - viewWidth;
+    }
+    if (viewX < 0) {
+        viewX = 0;
+    }
+    if (viewY > height - viewHeight) {
+        viewY = height - viewHeight;
+    }
+    if (viewY < 0) {
+        viewY = 0;
+    }
+
+    // Print tanks, only cells changed since the last render are sent to ncurses
+    std::vector<chtype> row(viewWidth);
+    if (zoom == 0) {
+        for (int curY = 0; curY < viewHeight; curY++) {
+            const uint8_t *fields = &board[(size_t) (viewY + curY) * x + viewX];
+            for (int curX = 0; curX < viewWidth; curX++) {
+                row[curX] = fieldGlyph(fields[curX]);
+            }
+            printChangedCells(curY, row.data());
+        }
+    } else {
+        const BlockCount *blocks = reducedBoard(zoom);
+        for (int curY = 0; curY < viewHeight; curY++) {
+            const BlockCount *rowBlocks = &blocks[(size_t) (viewY + curY) * width + viewX];
+            for (int curX = 0; curX < viewWidth; curX++) {
+                row[curX] = blockGlyph(rowBlocks[curX], zoom);
+            }
+            printChangedCells(curY, row.data());
+        }
+    }
+
+    printStatistics();
+    refresh();
+}
+
+void WorldClient::setZoom(int level)
+{
+    if (level < 0 || level > maxZoom() || level == zoom) {
+        return;
+    }
+
+    // Keep center of the viewport on the same place of the gameboard
+    long centerX = ((long) viewX * 2 + viewWidth) << zoom;
+    long centerY = ((long) viewY * 2 + viewHeight) << zoom;
+    zoom = level;
+    viewX = (int) (((centerX >> zoom) - viewWidth) / 2);
+    viewY = (int) (((centerY >> zoom) - viewHeight) / 2);
+}
+
+void WorldClient::printChangedCells(int row, const chtype *cells)
+{
+    chtype *rendered = &screenCells[(size_t) row * viewWidth];
+
+    int curX = 0;
+    while (curX < viewWidth) {
+        if (cells[curX] == rendered[curX]) {
+            curX++;
+            continue;
+        }
+
+        // Coalesce changed cells of the same color into one run
+        int runStart = curX;
+        attr_t color = cells[curX] & A_COLOR;
+        while (curX < viewWidth && cells[curX] != rendered[curX] && (cells[curX] & A_COLOR) == color) {
+            rendered[curX] = cells[curX];
+            curX++;
+        }
+        mvaddchnstr(row + 1, runStart + 1, rendered + runStart, curX - runStart);
+    }
+}
+
+void WorldClient::printStatistics()
+{
+    attron(COLOR_PAIR(1));
+    mvprintw(viewHeight + 2, 0, _("rendered: %lu  dropped: %lu  latency: %.1f ms  view: %d,%d  zoom: 1:%d  hash: %016llx"),
+             renderedFrames, droppedFrames, lastLatency.count() / 1000.0,
+             viewX << zoom, viewY << zoom, 1 << zoom, (unsigned long long) lastHash);
+    clrtoeol();
+}
+
 //send signal to world process
 int WorldClient::signalWorld(int signal)
 {
@@ -152,19 +501,6 @@ int WorldClient::signalWorld(int signal)
     return -1;
 }
 
-char WorldClient::readFieldFromPipe()
-{
-    char field[2];
-    if (read(pipe, field, 2) == -1) {
-        syslog(LOG_ERR, "couldn't ->read<- field from pipe");
-    }
-    if (field[1] != ',') {
-        syslog(LOG_ERR, "illegal field separator from pipe");
-    }
-    return field[0];
-
-}
-
 int WorldClient::handleInput()
 {
     int input;
@@ -179,87 +515,140 @@ int WorldClient::handleInput()
                 break;
             case 'r':
                 this->signalWorld(SIGUSR1);
-            default: //in case of none or unknown input do nothing
                 break;
+            case KEY_LEFT:
+            case 'h':
+                viewX -= viewWidth / 4 + 1;
+                break;
+            case KEY_RIGHT:
+            case 'l':
+                viewX += viewWidth / 4 + 1;
+                break;
+            case KEY_UP:
+            case 'k':
+                viewY -= viewHeight / 4 + 1;
+                break;
+            case KEY_DOWN:
+            case 'j':
+                viewY += viewHeight / 4 + 1;
+                break;
+            case '-':
+                setZoom(zoom + 1);
+                break;
+            case '+':
+                setZoom(zoom - 1);
+                break;
+            case KEY_RESIZE:
+                break;
+            default: //in case of none or unknown input do nothing
+                continue;
         }
+        printViewport();
     }
     return 0;
 }
 
-void WorldClient::printGameboard()
+size_t WorldClient::decodeFrame(size_t body, int frameX, int frameY)
 {
-    syslog(LOG_INFO, "round starts.");
+    // Reduced levels are built again on demand
+    x = frameX;
+    y = frameY;
+    board.resize((size_t) x * y);
+    levels.clear();
+    const char *field = pipeBuffer.data() + body;
+    for (size_t i = 0; i < board.size(); i++, field += 2) {
+        board[i] = decodeField(field);
+    }
+    return body + 2 * board.size();
+}
 
-    // Print frame
-    if(printGameboardFrame() == -2){
-        return;
+int WorldClient::printGameboard()
+{
+    size_t frameStart = 0;
+    size_t body = 0;
+    int frameX = 0;
+    int frameY = 0;
+    uint64_t hash = 0;
+
+    int ret_val = findNewestFrame(frameStart, frameX, frameY, hash, body);
+    if (ret_val == -1) {
+        syslog(LOG_ERR, "illegal frame header from pipe, dropping %lu bytes",
+               (unsigned long) pipeBuffer.size());
+        consumePipeBuffer(pipeBuffer.size());
+        return 0;
+    }
+    if (ret_val == 1) {
+        return 0;
     }
 
-    // Print tanks
-    for (int y = 1; y <= this->y; y++) {
-        for (int x = 1; x <= this->x; x++) {
-            char tank = readFieldFromPipe();
-
-            switch (tank)
-            {
-                case '0':
-                    mvaddch(y, x, ' ');
-                    break;
-                case 'g':
-                    attron(COLOR_PAIR(2));
-                    mvaddch(y, x, 'X');
-                    break;
-                case 'r':
-                    attron(COLOR_PAIR(3));
-                    mvaddch(y, x, 'X');
-                    break;
-                default:
-                    syslog(LOG_ERR, "illegal field input: %c", tank);
-            }
-        }
+    // Respect maximal render rate, frames which come meanwhile replace this one
+    if (Clock::now() < lastRender + minFrameInterval) {
+        return 1;
     }
+
+    syslog(LOG_INFO, "round starts.");
+
+    size_t frameEnd = decodeFrame(body, frameX, frameY);
+    lastRender = Clock::now();
+    lastLatency = std::chrono::duration_cast<std::chrono::microseconds>(lastRender - arrivalOf(frameEnd - 1));
+    renderedFrames++;
+    lastHash = hash;
+    consumePipeBuffer(frameEnd);
+
+    printViewport();
+    return 0;
 }
 
-int main(int argc, char ** argv)
+int WorldClient::run()
 {
-    setlocale(LC_ALL, "");
-    bindtextdomain("worldclient", "../locale");
-    textdomain("worldclient");
-
-    //handle main arguments
-    char * pipe = nullptr;
-    char opt;
-    while ((opt = (char) getopt_long(argc, argv, "p:h", LONG_ARGS, NULL)) != -1) {
-        switch (opt)
-        {
-            case 'p': //pipe
-                pipe = optarg;
-                break;
-            case 'h': //pipe
-                printHelp();
-                exit(0);
-            default:
-                printHelp();
-                exit(1);
+    struct pollfd fds[2];
+    fds[0].events = POLLIN;
+    fds[1].fd = STDIN_FILENO;
+    fds[1].events = POLLIN;
+
+    int waiting = 0;
+    while (true) {
+        struct timespec timeout;
+        struct timespec *timeoutPtr = nullptr;
+        if (waiting) {
+            auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    lastRender + minFrameInterval - Clock::now()).count();
+            if (remaining < 0) {
+                remaining = 0;
+            }
+            timeout.tv_sec = remaining / 1000000000;
+            timeout.tv_nsec = remaining % 1000000000;
+            timeoutPtr = &timeout;
+        }
+
+        // Sleep until world writes, user presses a key or the next render is allowed
+        fds[0].fd = pipe;
+        if (ppoll(fds, 2, timeoutPtr, NULL) == -1) {
+            if (errno != EINTR) {
+                syslog(LOG_ERR, "ppoll() failed: %s", strerror(errno));
+                return -1;
+            }
+            // Terminal resize is reported by getch()
+            fds[0].revents = 0;
+            fds[1].revents = POLLIN;
         }
-    }
-    if (pipe == nullptr) {
-        std::cout << _("-p option required.") << std::endl;
-        syslog(LOG_ERR, "Argument pipe is required. Exitting");
-        return -1;
-    }
 
-    try {
-        WorldClient wc (pipe);
+        if ((fds[1].revents & POLLIN) && handleInput() == -1) {
+            return 0;
+        }
 
-        while (wc.handleInput() != -1) {
-            wc.printGameboard();
+        int ret_val = 0;
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if ((ret_val = fillPipeBuffer()) == -1) {
+                return -1;
+            }
         }
 
-    } catch (std::runtime_error &err){
-        syslog(LOG_ERR, "caught exception: %s", err.what());
-        return -1;
-    }
+        waiting = printGameboard();
 
-    return 0;
+        // Incomplete frame of a closed world would break the stream of the next one
+        if (ret_val == -2 && !waiting) {
+            consumePipeBuffer(pipeBuffer.size());
+        }
+    }
 }
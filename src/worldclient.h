@@ -8,19 +8,62 @@
 #include <ncurses.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <cstdint>
 #include <iosfwd>
 #include <fstream>
+#include <string>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 #define WORLD_PATH "world.pid"
 
 class WorldClient {
+    friend class Benchmark;
+
 private:
+    typedef std::chrono::steady_clock Clock;
+
+    enum Field : uint8_t
+    {
+        EMPTY_FIELD, GREEN_FIELD, RED_FIELD
+    };
+
+    /**
+     * Number of tanks of each team in a block of gameboard
+     */
+    struct BlockCount
+    {
+        uint32_t green;
+        uint32_t red;
+    };
+
     int y;
     int x;
     int pipe;
     std::string pipeName;
 
+    std::string pipeBuffer;     //<< data read from pipe which were not rendered yet
+    std::vector<std::pair<size_t, Clock::time_point> > arrivals;    //<< end offsets of reads in pipeBuffer
+
+    std::vector<uint8_t> board;         //<< fields of the last frame, row by row
+    std::vector<std::vector<BlockCount> > levels;  //<< board reduced to blocks of 2^k x 2^k fields, from k = 1
+
+    int zoom;           //<< one screen cell shows 2^zoom x 2^zoom fields
+    int viewX;          //<< left column of viewport in cells of current zoom level
+    int viewY;          //<< top row of viewport in cells of current zoom level
+    int viewWidth;
+    int viewHeight;
+    std::vector<chtype> screenCells;    //<< cells of the last rendered viewport, row by row
+
+    std::chrono::microseconds minFrameInterval;     //<< zero means unlimited render rate
+    Clock::time_point lastRender;
+    unsigned long renderedFrames;
+    unsigned long droppedFrames;
+    std::chrono::microseconds lastLatency;
+    uint64_t lastHash;          //<< hash of gameboard of the last rendered frame
+
     /**
      * Send signal to world process
      * @param signal number
@@ -28,43 +71,141 @@ private:
     int signalWorld(int);
 
     /**
-     * Wait until pipe become ready for reading with timeout
-     * @return 0 if pipe is ready and -1 if timeout expires
+     * (Re)open the named pipe without waiting for world
+     * @return 0 on success, -1 on error
+     */
+    int openPipe();
+
+    /**
+     * Read everything what is available in pipe at the moment into pipeBuffer. Never blocks.
+     * @return 0 on success, -1 on error and -2 if world closed the pipe and it was reopened
+     */
+    int fillPipeBuffer();
+
+    /**
+     * Parse frame header "<X>,<Y>,<hash>," at given offset of pipeBuffer. Fields of the frame are not decoded.
+     * @param offset where the frame starts
+     * @param frameX, frameY size of the frame
+     * @param hash hash of gameboard, up to 16 hex digits
+     * @param body offset of the first field
+     * @return 0 if whole frame is in pipeBuffer, 1 if it is incomplete and -1 if header is malformed
+     */
+    int parseFrameHeader(size_t offset, int & frameX, int & frameY, uint64_t & hash, size_t & body) const;
+
+    /**
+     * Find the newest complete frame in pipeBuffer. Older complete frames are counted as dropped.
+     * @param frameStart, body offsets of the found frame
+     * @return 0 if frame was found, 1 if there is no complete frame and -1 if pipe data are malformed
+     */
+    int findNewestFrame(size_t & frameStart, int & frameX, int & frameY, uint64_t & hash, size_t & body);
+
+    /**
+     * Decode fields of frame into board
+     * @param body offset of the first field in pipeBuffer
+     * @return offset after the end of the frame
+     */
+    size_t decodeFrame(size_t body, int frameX, int frameY);
+
+    /**
+     * Remove first count bytes from pipeBuffer and shift arrival offsets accordingly
+     */
+    void consumePipeBuffer(size_t count);
+
+    /**
+     * Get time when byte at given offset of pipeBuffer was read from pipe
      */
-    int checkIfPipeIsReady();
+    Clock::time_point arrivalOf(size_t offset) const;
 
     /**
-     * Reads two integers from current position in ifs to x and y
+     * Print frame around the viewport. Screen is cleared when size of viewport changed.
      */
-    int readGameBoardSize();
+    int printGameboardFrame(int width, int height);
 
     /**
-     * Reads one field from pipe file stream
-     * @return -1 on error, 0
+     * Translate one field from pipe into Field
      */
-    char readFieldFromPipe();
+    static uint8_t decodeField(const char *field);
 
     /**
-     * Init gameboard - starts ncurses, print game frame and statistics
+     * Get gameboard reduced to blocks of 2^level x 2^level fields. Missing levels are built from
+     * the nearest lower level, so each level is computed at most once per frame.
+     * @param level greater than zero
      */
-    int printGameboardFrame();
+    const BlockCount *reducedBoard(int level);
+
+    int levelWidth(int level) const;
+
+    int levelHeight(int level) const;
+
+    /**
+     * Get the lowest zoom level which shows whole gameboard in one cell
+     */
+    int maxZoom() const;
+
+    static chtype fieldGlyph(uint8_t field);
+
+    /**
+     * Get character showing density of tanks in block, colored by majority team
+     */
+    static chtype blockGlyph(const BlockCount & block, int level);
+
+    /**
+     * Print part of the last frame which is visible in viewport
+     */
+    void printViewport();
+
+    /**
+     * Change zoom level and keep center of the viewport
+     */
+    void setZoom(int level);
+
+    /**
+     * Print cells of one viewport row which differ from the last rendered frame
+     * @param row index of viewport row
+     * @param cells new content of the row
+     */
+    void printChangedCells(int row, const chtype *cells);
+
+    /**
+     * Print rendered and dropped frame counters and latency of the last frame under the gameboard
+     */
+    void printStatistics();
+
+    /**
+     * Client without terminal and pipe, used by benchmarks of frame parsing
+     */
+    WorldClient();
 
 public:
 
-    WorldClient(char *);
+    /**
+     * @param path of the named pipe
+     * @param maxFps maximal number of rendered frames per second, 0 means unlimited
+     */
+    WorldClient(char *, unsigned int maxFps = 0);
 
     virtual ~WorldClient()
     {
-        endwin();
-        close(pipe);
-        unlink(pipeName.c_str());
+        if (!pipeName.empty()) {
+            endwin();
+            close(pipe);
+            unlink(pipeName.c_str());
+        }
     }
 
     /**
-     * Print gameboard from pipe
-     * @return 0 if gameboard was printed and -1 if timeout expires and nothing was printed
+     * Wait for frames from pipe and input from user and handle them until user exits.
+     * Nothing is done between frames, the process sleeps in ppoll().
+     * @return 0 if user exits and -1 on error
+     */
+    int run();
+
+    /**
+     * Print the newest complete gameboard read from pipe. Frames which became obsolete before
+     * they could be rendered are skipped.
+     * @return 1 if a frame waits until the maximal render rate allows to print it, 0 otherwise
      */
-    void printGameboard();
+    int printGameboard();
 
     /**
      * Non-blocking read input from user.